@@ -3,13 +3,25 @@
 #include "state.h"
 #include "search.h"
 #include "normalization.h"
+#include "prefix.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "trace.h"
+#include "checkpoint.h"
+
+#ifdef TRACK_ALLOCATIONS
+#include "alloc_hooks.h"
+#endif
 
 #include <iostream>
 #include <chrono>
 #include <csignal>
+#include <cstdio>
 #include <atomic>
 #include <memory>
 
+// Set by the first Ctrl-C; the search stops within a rollout and reports the
+// best network so far. A second Ctrl-C exits at once.
 std::atomic<bool> exit_flag{false};
 
 void signal_handler(int) {
@@ -21,14 +33,14 @@ void signal_handler(int) {
 }
 
 template<int NetSize>
-void print_results(const State<NetSize>& state, int length, int depth, int net_size) {
+void print_results(const State<NetSize>& state, int length, int depth) {
     // Make a copy and canonicalize the operations
     std::vector<Operation> normalized_ops;
     normalized_ops.reserve(state.current_level);
     for (int i = 0; i < state.current_level; ++i) {
         normalized_ops.push_back(state.operations[i]);
     }
-    canonical_normalize<NetSize>(normalized_ops, state.current_level, net_size);
+    canonical_normalize<NetSize>(normalized_ops, state.current_level);
 
     // Print the canonicalized network
     for (int i = 0; i < state.current_level; ++i) {
@@ -40,30 +52,158 @@ void print_results(const State<NetSize>& state, int length, int depth, int net_s
     std::cout << std::endl;
 }
 
+// Check that a checkpoint can be continued with this configuration: every
+// parameter that shapes the beam must be the one it was written with, or the
+// resumed run would be a different search. The two-layer prefixes are checked
+// by run_search(), which enumerates them.
+void check_resumable(const SearchCheckpoint& checkpoint, const Config& config) {
+    auto mismatch = [](const std::string& option, const std::string& value) {
+        return std::invalid_argument("The checkpoint was written with " + option + " " + value +
+                                     ", so it can only be resumed with the same value");
+    };
+    if (checkpoint.net_size != config.get_net_size()) {
+        throw mismatch("-n", std::to_string(checkpoint.net_size));
+    }
+    if (checkpoint.max_beam_size != config.get_max_beam_size()) {
+        throw mismatch("-b", std::to_string(checkpoint.max_beam_size));
+    }
+    if (checkpoint.num_scoring_tests != config.get_num_scoring_iterations()) {
+        throw mismatch("-t", std::to_string(checkpoint.num_scoring_tests));
+    }
+    if (checkpoint.depth_weight != config.get_depth_weight()) {
+        char depth_weight[32];
+        std::snprintf(depth_weight, sizeof(depth_weight), "%.17g", checkpoint.depth_weight);
+        throw mismatch("-w", depth_weight);
+    }
+    if ((checkpoint.use_symmetry != 0) != config.get_use_symmetry_heuristic()) {
+        throw std::invalid_argument(std::string("The checkpoint was written with ") +
+                                    (checkpoint.use_symmetry ? "-s" : "-S") + ", so it can only be resumed with it");
+    }
+    if ((checkpoint.two_layer_prefixes != 0) != config.get_use_two_layer_prefixes()) {
+        throw std::invalid_argument(checkpoint.two_layer_prefixes ? "The checkpoint was written with -l, so it can only be resumed with it"
+                                                                  : "The checkpoint was written without -l, so it cannot be resumed with it");
+    }
+    if (!checkpoint.two_layer_prefixes && (checkpoint.prefix.size() != config.get_prefix().size() ||
+                                           !starts_with_operations(checkpoint.prefix.data(), config.get_prefix()))) {
+        throw std::invalid_argument("The checkpoint started from a different prefix (" +
+                                    std::to_string(checkpoint.prefix.size()) + " operations) than --prefix");
+    }
+    if (checkpoint.level >= config.get_length_upper_bound()) {
+        throw std::invalid_argument("The checkpoint's level is beyond the length upper bound");
+    }
+}
+
 template<int NetSize>
-void run_search(const Config& config) {
+void run_search(const Config& config, MetricsWriter* metrics, Tracer* tracer, const SearchCheckpoint* resume) {
+    HugePageRegistry::instance().set_mode(config.get_huge_page_mode());
+
     LookupTables lookups;
     lookups.initialize(config);
 
-    BeamSearchContext beam_context(config);
+    BeamSearchContext<NetSize> beam_context(config, lookups);
+    if (tracer != nullptr) beam_context.set_tracer(tracer);
+    beam_context.set_cancel_flag(&exit_flag);
+    if (!config.get_snapshot_levels().empty()) {
+        beam_context.set_snapshot_levels(config.get_snapshot_levels(), config.get_snapshot_dir());
+    }
+
+    // What only this loop knows of the search, for --checkpoint
+    SearchCheckpoint progress;
+    int first_iteration = 0;
+    if (resume != nullptr) {
+        beam_context.resume_from(*resume);
+        progress.elapsed_seconds = resume->elapsed_seconds;
+        progress.best_length = resume->best_length;
+        progress.best_depth = resume->best_depth;
+        progress.best = resume->best;
+        // A checkpoint without a beam was written after its iteration finished
+        first_iteration = resume->beam_size > 0 ? resume->iteration - 1 : resume->iteration;
+    }
+    if (!config.get_checkpoint_file().empty()) {
+        beam_context.set_checkpoint(config.get_checkpoint_file(), config.get_checkpoint_interval(), &progress);
+    }
 
     auto state = std::make_unique<State<NetSize>>(config);
+    auto start_state = std::make_unique<State<NetSize>>(config);
 
     auto start_time = std::chrono::steady_clock::now();
 
     std::signal(SIGINT, signal_handler);
 
     config.print();
+    print_memory_estimate(estimate_memory(config, config.get_max_beam_size(),
+                                          count_lookup_copies(config.get_num_threads(), config.get_pin_threads())),
+                          config.get_memory_budget());
+
+    if (config.get_huge_page_mode() != HugePageMode::Off) {
+        std::size_t total_bytes, huge_bytes;
+        HugePageRegistry::instance().usage(total_bytes, huge_bytes);
+        std::cout << "Huge pages              : " << (huge_bytes >> 20) << " of " << (total_bytes >> 20)
+                  << " MiB in large arrays" << "\n" << std::endl;
+    }
+
+    // Each iteration starts from the next prefix in turn (round-robin).
+    std::vector<std::vector<Operation>> prefixes;
+    if (config.get_use_two_layer_prefixes()) {
+        prefixes = enumerate_two_layer_prefixes<NetSize>(config, lookups);
+        std::cout << "Two-layer prefixes      : " << prefixes.size() << "\n" << std::endl;
+    } else {
+        prefixes.push_back(config.get_prefix());
+    }
+
+    // The prefix list is the same in every run with the same parameters, so the
+    // resumed iteration must start from the prefix it was saved with
+    if (resume != nullptr) {
+        const auto& prefix = prefixes[static_cast<std::size_t>(resume->iteration - 1) % prefixes.size()];
+        if (prefix.size() != resume->prefix.size() || !starts_with_operations(resume->prefix.data(), prefix)) {
+            throw std::invalid_argument("The checkpoint's prefix is not the one this run would start iteration " +
+                                        std::to_string(resume->iteration) + " from");
+        }
+    }
+
+    if (resume != nullptr) {
+        std::cout << "Resuming " << config.get_resume_file() << " at iteration " << (first_iteration + 1);
+        if (resume->beam_size > 0) {
+            std::cout << ", level " << resume->level << " (" << resume->beam_size << " beam entries)";
+        }
+        if (resume->best_length > 0) {
+            std::cout << ", best so far length " << resume->best_length << " depth " << resume->best_depth;
+        }
+        std::cout << "\n" << std::endl;
+    }
 
     int current_iteration;
-    for (current_iteration = 0; current_iteration < config.get_max_iterations() && !exit_flag.load(); ++current_iteration) {
-        std::cout << "Iteration " << (current_iteration + 1) << ':' << std::endl;
+    for (current_iteration = first_iteration; current_iteration < config.get_max_iterations() && !exit_flag.load(); ++current_iteration) {
+        const std::size_t prefix_index = static_cast<std::size_t>(current_iteration) % prefixes.size();
+        std::cout << "Iteration " << (current_iteration + 1);
+        if (prefixes.size() > 1) {
+            std::cout << " (prefix " << (prefix_index + 1) << '/' << prefixes.size() << ')';
+        }
+        std::cout << ':' << std::endl;
+        if (metrics != nullptr) metrics->set_iteration(current_iteration + 1);
+        progress.iteration = current_iteration + 1;
+        progress.prefix = prefixes[prefix_index];
 
-        int length = beam_context.beam_search(*state, config, lookups);
-        state->minimise_depth(config.get_net_size());
-        int depth = state->get_depth(config.get_net_size());
+        // Apply the prefix network (if any) once; the beam search starts from here.
+        start_state->set_start_state(config, lookups);
+        for (const auto& op : prefixes[prefix_index]) {
+            start_state->update_state(op.op1, op.op2, lookups);
+        }
 
-        print_results(*state, length, depth, config.get_net_size());
+        int length = beam_context.beam_search(*state, *start_state, config, lookups, metrics);
+        if (length == SEARCH_CANCELLED) break;
+        state->minimise_depth();
+        int depth = state->get_depth();
+
+        print_results(*state, length, depth);
+
+        if (progress.best_length == 0 || length < progress.best_length ||
+            (length == progress.best_length && depth < progress.best_depth)) {
+            progress.best_length = length;
+            progress.best_depth = depth;
+            progress.best.assign(state->operations.begin(), state->operations.begin() + state->current_level);
+        }
+        beam_context.save_checkpoint(config);
 
         if (length < config.get_length_lower_bound() || depth < config.get_depth_lower_bound()) {
             ++current_iteration;
@@ -71,62 +211,94 @@ void run_search(const Config& config) {
         }
 
         state = std::make_unique<State<NetSize>>(config);
-        beam_context = BeamSearchContext(config);
+    }
+
+    if (exit_flag.load()) {
+        std::cout << "Interrupted";
+        if (progress.best_length == 0) {
+            std::cout << " before any network was found\n" << std::endl;
+        } else {
+            std::cout << ", best network so far:" << std::endl;
+            state->set_start_state(config, lookups);
+            for (const auto& op : progress.best) {
+                state->update_state(op.op1, op.op2, lookups);
+            }
+            print_results(*state, progress.best_length, progress.best_depth);
+        }
     }
 
     auto end_time = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration<double>(end_time - start_time).count();
+    auto elapsed = std::chrono::duration<double>(end_time - start_time).count() + progress.elapsed_seconds;
 
     std::cout << "Total Iterations  : " << current_iteration << std::endl;
     std::cout << "Total Time        : " << elapsed << " seconds" << std::endl;
+    print_perf_summary(beam_context.perf_totals);
+
+    if (tracer != nullptr) {
+        tracer->write();
+        std::cout << "Trace written to " << config.get_trace_file() << std::endl;
+    }
 }
 
 int main(int argc, char* argv[]) {
     Config config;
+    std::unique_ptr<MetricsWriter> metrics;
+    std::unique_ptr<Tracer> tracer;
+    std::unique_ptr<SearchCheckpoint> resume;
 
     try {
         config.parse_args(argc, argv);
+        if (!config.get_metrics_file().empty()) {
+            metrics = std::make_unique<MetricsWriter>(config.get_metrics_file());
+        }
+        if (!config.get_trace_file().empty()) {
+            tracer = std::make_unique<Tracer>(config.get_trace_file());
+        }
+        if (!config.get_resume_file().empty()) {
+            resume = std::make_unique<SearchCheckpoint>(read_checkpoint(config.get_resume_file()));
+            check_resumable(*resume, config);
+        }
+
+        switch (config.get_net_size()) {
+            case 2: run_search<2>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 3: run_search<3>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 4: run_search<4>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 5: run_search<5>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 6: run_search<6>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 7: run_search<7>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 8: run_search<8>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 9: run_search<9>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 10: run_search<10>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 11: run_search<11>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 12: run_search<12>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 13: run_search<13>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 14: run_search<14>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 15: run_search<15>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 16: run_search<16>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 17: run_search<17>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 18: run_search<18>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 19: run_search<19>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 20: run_search<20>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 21: run_search<21>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 22: run_search<22>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 23: run_search<23>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 24: run_search<24>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 25: run_search<25>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 26: run_search<26>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 27: run_search<27>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 28: run_search<28>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 29: run_search<29>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 30: run_search<30>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 31: run_search<31>(config, metrics.get(), tracer.get(), resume.get()); break;
+            case 32: run_search<32>(config, metrics.get(), tracer.get(), resume.get()); break;
+            default:
+                std::cerr << "Error: Unsupported net_size. Must be between 2 and 32.\n";
+                return 1;
+        }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
         return 1;
     }
 
-    switch (config.get_net_size()) {
-        case 2: run_search<2>(config); break;
-        case 3: run_search<3>(config); break;
-        case 4: run_search<4>(config); break;
-        case 5: run_search<5>(config); break;
-        case 6: run_search<6>(config); break;
-        case 7: run_search<7>(config); break;
-        case 8: run_search<8>(config); break;
-        case 9: run_search<9>(config); break;
-        case 10: run_search<10>(config); break;
-        case 11: run_search<11>(config); break;
-        case 12: run_search<12>(config); break;
-        case 13: run_search<13>(config); break;
-        case 14: run_search<14>(config); break;
-        case 15: run_search<15>(config); break;
-        case 16: run_search<16>(config); break;
-        case 17: run_search<17>(config); break;
-        case 18: run_search<18>(config); break;
-        case 19: run_search<19>(config); break;
-        case 20: run_search<20>(config); break;
-        case 21: run_search<21>(config); break;
-        case 22: run_search<22>(config); break;
-        case 23: run_search<23>(config); break;
-        case 24: run_search<24>(config); break;
-        case 25: run_search<25>(config); break;
-        case 26: run_search<26>(config); break;
-        case 27: run_search<27>(config); break;
-        case 28: run_search<28>(config); break;
-        case 29: run_search<29>(config); break;
-        case 30: run_search<30>(config); break;
-        case 31: run_search<31>(config); break;
-        case 32: run_search<32>(config); break;
-        default:
-            std::cerr << "Error: Unsupported net_size. Must be between 2 and 32.\n";
-            return 1;
-    }
-
     return 0;
 }
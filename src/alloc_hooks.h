@@ -0,0 +1,38 @@
+#pragma once
+
+#include "alloc_tracking.h"
+#include <cstdlib>
+#include <new>
+
+// Replacement global allocation functions that count into alloc_tracking.h.
+// Include this in exactly one translation unit of a program built with
+// -DTRACK_ALLOCATIONS. The array and nothrow forms are not replaced: the
+// standard library implements them in terms of these.
+
+namespace alloc_hooks {
+
+inline void count(std::size_t bytes) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+}  // namespace alloc_hooks
+
+[[gnu::noinline]] void* operator new(std::size_t bytes) {
+    alloc_hooks::count(bytes);
+    if (void* ptr = std::malloc(bytes == 0 ? 1 : bytes)) return ptr;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(std::size_t bytes, std::align_val_t align) {
+    alloc_hooks::count(bytes);
+    const std::size_t alignment = static_cast<std::size_t>(align);
+    const std::size_t rounded = (bytes + alignment - 1) / alignment * alignment;
+    if (void* ptr = std::aligned_alloc(alignment, rounded == 0 ? alignment : rounded)) return ptr;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* ptr) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Heap allocation accounting, for finding allocations in code that should not
+// make any.
+//
+// Built with -DTRACK_ALLOCATIONS (make alloc-stats), the program replaces the
+// global operator new (see alloc_hooks.h) to count every allocation and its size.
+// The search then reports the allocations of each phase and level in its
+// --metrics records. In other builds nothing is replaced and the counts stay zero.
+
+#ifdef TRACK_ALLOCATIONS
+inline constexpr bool ALLOCATION_TRACKING = true;
+#else
+inline constexpr bool ALLOCATION_TRACKING = false;
+#endif
+
+struct AllocCounts {
+    std::uint64_t count = 0;
+    std::uint64_t bytes = 0;
+
+    AllocCounts& operator+=(const AllocCounts& other) {
+        count += other.count;
+        bytes += other.bytes;
+        return *this;
+    }
+
+    AllocCounts& operator-=(const AllocCounts& other) {
+        count -= other.count;
+        bytes -= other.bytes;
+        return *this;
+    }
+};
+
+// Process-wide totals, updated by the replaced operator new.
+inline std::atomic<std::uint64_t> allocation_count{0};
+inline std::atomic<std::uint64_t> allocation_bytes{0};
+
+inline AllocCounts read_allocation_counts() {
+    return AllocCounts{allocation_count.load(std::memory_order_relaxed),
+                       allocation_bytes.load(std::memory_order_relaxed)};
+}
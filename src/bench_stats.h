@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Timing, statistics, JSON output and baseline comparison for the benchmark
+// programs (benchmark, replay_benchmark and e2e_benchmark).
+//
+// Every kernel is timed in several independent repeats, each giving one sample
+// in nanoseconds per operation. A result reports the mean of the samples with a
+// 95% confidence interval from Student's t distribution, so a difference between
+// two runs can be told apart from run-to-run noise.
+
+// Keep the compiler from discarding a result that is otherwise unused.
+template<typename T>
+inline void keep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Silences std::cout for the search's progress output while it exists.
+class SilenceOutput {
+public:
+    SilenceOutput() : saved_(std::cout.rdbuf(nullptr)) {}
+    ~SilenceOutput() {
+        std::cout.rdbuf(saved_);
+        std::cout.clear();
+    }
+
+    SilenceOutput(const SilenceOutput&) = delete;
+    SilenceOutput& operator=(const SilenceOutput&) = delete;
+
+private:
+    std::streambuf* saved_;
+};
+
+// Time run() in repeats repeats, each calling it until at least min_seconds
+// have been measured. setup() runs before every call, outside the timed region.
+// run() returns the number of operations it did. Returns one sample per
+// repeat, in nanoseconds per operation.
+template<typename Setup, typename Run>
+std::vector<double> measure_samples(int repeats, double min_seconds, Setup setup, Run run) {
+    setup();
+    static_cast<void>(run());  // Warm-up
+
+    std::vector<double> samples;
+    for (int repeat = 0; repeat < repeats; ++repeat) {
+        double seconds = 0.0;
+        std::uint64_t operations = 0;
+        do {
+            setup();
+            const auto start = std::chrono::steady_clock::now();
+            operations += run();
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (seconds < min_seconds);
+        samples.push_back(seconds * 1e9 / static_cast<double>(operations));
+    }
+    return samples;
+}
+
+// Parse a list of integers such as "8,10,12" or "4-24" for option, each in
+// [min, max]. Returns them sorted, without duplicates.
+inline std::vector<int> parse_int_list(const std::string& text, const std::string& option, int min, int max) {
+    std::vector<int> values;
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        int first = 0;
+        int last = 0;
+        try {
+            const std::size_t dash = item.find('-');
+            first = std::stoi(item.substr(0, dash));
+            last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+        } catch (const std::exception&) {
+            throw std::invalid_argument("Invalid value for " + option);
+        }
+        if (first < min || last > max || first > last) {
+            throw std::invalid_argument("Values of " + option + " must be between " + std::to_string(min) + " and " +
+                                        std::to_string(max));
+        }
+        for (int value = first; value <= last; ++value) values.push_back(value);
+    }
+    if (values.empty()) {
+        throw std::invalid_argument("Invalid value for " + option);
+    }
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    return values;
+}
+
+struct BenchResult {
+    std::string kernel;
+    int net_size = 0;
+    std::vector<double> samples;  // ns per operation, one per repeat
+    double mean = 0.0;
+    double stddev = 0.0;          // Sample standard deviation
+    double ci95 = 0.0;            // Half-width of the 95% confidence interval of the mean
+    double min = 0.0;
+    double max = 0.0;
+};
+
+// Two-sided 97.5% quantile of Student's t distribution with df degrees of freedom.
+inline double student_t_975(int df) {
+    static constexpr double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (df < 1) return 0.0;
+    if (df <= 30) return table[df - 1];
+    return 1.960;
+}
+
+inline BenchResult summarize_samples(const std::string& kernel, int net_size, std::vector<double> samples) {
+    BenchResult result;
+    result.kernel = kernel;
+    result.net_size = net_size;
+    result.samples = std::move(samples);
+    if (result.samples.empty()) return result;
+
+    const double n = static_cast<double>(result.samples.size());
+    double sum = 0.0;
+    for (double sample : result.samples) sum += sample;
+    result.mean = sum / n;
+
+    double squares = 0.0;
+    for (double sample : result.samples) squares += (sample - result.mean) * (sample - result.mean);
+    const int df = static_cast<int>(result.samples.size()) - 1;
+    result.stddev = df > 0 ? std::sqrt(squares / df) : 0.0;
+    result.ci95 = df > 0 ? student_t_975(df) * result.stddev / std::sqrt(n) : 0.0;
+
+    const auto [min, max] = std::minmax_element(result.samples.begin(), result.samples.end());
+    result.min = *min;
+    result.max = *max;
+    return result;
+}
+
+// Human-readable duration of one operation, e.g. "12.3 us".
+inline std::string format_nanoseconds(double ns) {
+    char text[32];
+    if (ns >= 1e9) std::snprintf(text, sizeof(text), "%.3f s", ns / 1e9);
+    else if (ns >= 1e6) std::snprintf(text, sizeof(text), "%.3f ms", ns / 1e6);
+    else if (ns >= 1e3) std::snprintf(text, sizeof(text), "%.3f us", ns / 1e3);
+    else std::snprintf(text, sizeof(text), "%.1f ns", ns);
+    return text;
+}
+
+inline void print_result(const BenchResult& result) {
+    const double relative = result.mean > 0.0 ? 100.0 * result.ci95 / result.mean : 0.0;
+    char line[160];
+    std::snprintf(line, sizeof(line), "  %-24s n=%-3d %12s/op  +- %5.1f%%  (%zu runs)\n", result.kernel.c_str(),
+                  result.net_size, format_nanoseconds(result.mean).c_str(), relative, result.samples.size());
+    std::cout << line;
+}
+
+// Write the results as one JSON document with one result object per line, which
+// is also the format load_baseline() reads back.
+inline void write_results_json(const std::string& path, const std::vector<BenchResult>& results,
+                               const std::string& cpu_dispatch, int num_threads, int repeats) {
+    std::ofstream out(path, std::ios::out | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+    out.precision(9);
+    out << "{\"cpu_dispatch\":\"" << cpu_dispatch << "\",\"threads\":" << num_threads << ",\"repeats\":" << repeats
+        << ",\"unit\":\"ns/op\",\"results\":[\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "{\"kernel\":\"" << r.kernel << "\",\"n\":" << r.net_size << ",\"mean\":" << r.mean
+            << ",\"stddev\":" << r.stddev << ",\"ci95\":" << r.ci95 << ",\"min\":" << r.min << ",\"max\":" << r.max
+            << ",\"samples\":[";
+        for (std::size_t s = 0; s < r.samples.size(); ++s) out << (s > 0 ? "," : "") << r.samples[s];
+        out << "]}" << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+    out << "]}\n";
+}
+
+struct BaselineEntry {
+    double mean = 0.0;
+    double ci95 = 0.0;
+};
+
+using Baseline = std::map<std::pair<std::string, int>, BaselineEntry>;
+
+// Read the results of a file written by write_results_json().
+inline Baseline load_baseline(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Cannot open baseline " + path + ": " + std::strerror(errno));
+    }
+
+    auto field = [](const std::string& line, const char* key) -> std::string {
+        const std::string quoted = std::string("\"") + key + "\":";
+        const std::size_t start = line.find(quoted);
+        if (start == std::string::npos) return {};
+        const std::size_t begin = start + quoted.size();
+        if (line[begin] == '"') return line.substr(begin + 1, line.find('"', begin + 1) - begin - 1);
+        return line.substr(begin, line.find_first_of(",}", begin) - begin);
+    };
+
+    Baseline baseline;
+    std::string line;
+    while (std::getline(in, line)) {
+        const std::string kernel = field(line, "kernel");
+        if (kernel.empty()) continue;
+        try {
+            BaselineEntry entry{std::stod(field(line, "mean")), std::stod(field(line, "ci95"))};
+            baseline[{kernel, std::stoi(field(line, "n"))}] = entry;
+        } catch (const std::exception&) {
+            throw std::runtime_error("Malformed result in baseline " + path + ": " + line);
+        }
+    }
+    if (baseline.empty()) {
+        throw std::runtime_error("No results found in baseline " + path);
+    }
+    return baseline;
+}
+
+// Compare results with a baseline and print the change of each. A result is a
+// regression when its mean is more than threshold (e.g. 0.1 = 10%) slower than
+// the baseline's and the two confidence intervals do not overlap, so noisy
+// kernels are not reported on the strength of a single slow repeat. Returns the
+// number of regressions.
+inline int compare_to_baseline(const std::vector<BenchResult>& results, const Baseline& baseline, double threshold) {
+    int regressions = 0;
+    std::cout << "Comparison with baseline (regression threshold " << threshold * 100.0 << "%):\n";
+    for (const BenchResult& result : results) {
+        const auto it = baseline.find({result.kernel, result.net_size});
+        if (it == baseline.end() || it->second.mean <= 0.0) continue;
+
+        const BaselineEntry& base = it->second;
+        const double change = result.mean / base.mean - 1.0;
+        const bool regressed = change > threshold && result.mean - result.ci95 > base.mean + base.ci95;
+        regressions += regressed ? 1 : 0;
+
+        char line[192];
+        std::snprintf(line, sizeof(line), "  %-24s n=%-3d %12s -> %12s  %+7.1f%%%s\n", result.kernel.c_str(),
+                      result.net_size, format_nanoseconds(base.mean).c_str(), format_nanoseconds(result.mean).c_str(),
+                      100.0 * change, regressed ? "  REGRESSION" : "");
+        std::cout << line;
+    }
+    return regressions;
+}
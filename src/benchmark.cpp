@@ -1,116 +1,585 @@
 #include "state.h"
 #include "search.h"
+#include "memory_budget.h"
+#include "bench_stats.h"
+
+// Only the make bench-alloc build counts heap allocations, for the steady-state
+// allocation check; the timings of every other build use the plain operator new.
+#ifdef TRACK_ALLOCATIONS
+#include "alloc_hooks.h"
+#endif
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
 
-const int iterations = 10'000;
+// Benchmarks of every search kernel for a range of network sizes.
+//
+// Each kernel is timed in --repeats independent runs of at least --min-time
+// seconds, and reported in nanoseconds per operation with a 95% confidence
+// interval. Results can be written as JSON and compared against an earlier
+// JSON file, failing when a kernel got slower than --threshold.
+//
+// Single-state kernels run on random networks built by rollouts from the empty
+// network. The level kernels run on a real search level: the search is run from
+// the empty network until a level has more candidates than the beam holds, so
+// that selection has to halve them.
 
-template<int NetSize>
-void benchmark_score_state(const Config& config, const LookupTables& lookups) {
-    State<NetSize> state(config);
-    state.set_start_state(config, lookups);
+struct BenchmarkOptions {
+    std::vector<int> sizes;
+    int repeats = 10;
+    double min_seconds = 0.05;
+    int beam_size = 100;
+    int num_tests = 5;
+    int num_threads = 0;
+    int max_level_size = 12;  // Largest size for the level kernels and the allocation check
+    std::string filter;
+    std::string json_file;
+    std::string baseline_file;
+    double threshold = 0.10;
 
-    // Warmup
-    for (int i = 0; i < 100; ++i) {
-        static_cast<void>(state.score_state(5, 0.0001, lookups));
+    [[nodiscard]] bool selected(const char* kernel) const {
+        return filter.empty() || std::string(kernel).find(filter) != std::string::npos;
     }
+};
 
-    auto start = std::chrono::steady_clock::now();
-    for (int i = 0; i < iterations; ++i) {
-        static_cast<void>(state.score_state(5, 0.0001, lookups));
-    }
-    auto end = std::chrono::steady_clock::now();
+inline constexpr int MIN_BENCH_SIZE = 4;
+inline constexpr int MAX_BENCH_SIZE = 24;
 
-    double elapsed = std::chrono::duration<double>(end - start).count();
-    std::cout << NetSize << ": " << (iterations / elapsed) << " calls/sec\n";
+// Random complete networks per size, used by the single-state kernels.
+inline constexpr int NUM_BENCH_NETWORKS = 32;
+
+// find_successors calls per timed run, so each run is long enough to time.
+inline constexpr int FIND_SUCCESSORS_BATCH = 16;
+
+template<typename Setup, typename Run>
+std::vector<double> measure(const BenchmarkOptions& options, Setup setup, Run run) {
+    return measure_samples(options.repeats, options.min_seconds, setup, run);
 }
 
-template<int NetSize>
-void benchmark_update_state(const Config& config, const LookupTables& lookups) {
-    State<NetSize> state(config);
-    state.set_start_state(config, lookups);
+template<typename Run>
+std::vector<double> measure(const BenchmarkOptions& options, Run run) {
+    return measure(options, [] {}, run);
+}
+
+struct RandomNetwork {
+    std::vector<Operation> operations;
+    int num_layers = 0;
+};
+
+// Records the largest level of one search, then checks the levels of another
+// search that are no larger (all buffers they need already exist) for heap
+// allocations.
+class SteadyStateAllocationCheck : public LevelObserver {
+public:
+    void on_level(const LevelMetrics& metrics) override {
+        if (!checking_) {
+            max_unique_ = std::max(max_unique_, metrics.unique);
+            return;
+        }
+        if (metrics.unique > max_unique_) return;
 
-    // Warmup
-    for (int i = 0; i < 100; ++i) {
-        state.update_state(0, 1, lookups);
-        state.set_start_state(config, lookups);
+        checked_levels_++;
+        if (metrics.level_allocations.count == 0) return;
+        failed_levels_++;
+        report_ << "  level " << metrics.level << " allocated " << metrics.level_allocations.count << " times ("
+                << metrics.level_allocations.bytes << " bytes):";
+        for (int phase = 0; phase < NUM_PHASES; ++phase) {
+            report_ << ' ' << PHASE_NAMES[phase] << ' ' << metrics.allocations[phase].count;
+        }
+        report_ << '\n';
     }
 
-    auto start = std::chrono::steady_clock::now();
-    for (int i = 0; i < iterations; ++i) {
-        state.update_state(0, 1, lookups);
-        state.set_start_state(config, lookups);
+    void start_checking() { checking_ = true; }
+    [[nodiscard]] int checked_levels() const { return checked_levels_; }
+    [[nodiscard]] int failed_levels() const { return failed_levels_; }
+    [[nodiscard]] std::string report() const { return report_.str(); }
+
+private:
+    std::ostringstream report_;
+    bool checking_ = false;
+    std::size_t max_unique_ = 0;
+    int checked_levels_ = 0;
+    int failed_levels_ = 0;
+};
+
+// Run a full search to size every buffer, then a second one checked for
+// allocations. Returns false if a steady-state level allocated.
+template<int NetSize>
+bool check_steady_state_allocations(const Config& config, const LookupTables& lookups) {
+    BeamSearchContext<NetSize> context(config, lookups);
+    State<NetSize> result(config);
+    State<NetSize> start_state(config);
+    start_state.set_start_state(config, lookups);
+    SteadyStateAllocationCheck check;
+
+    {
+        SilenceOutput quiet;
+        static_cast<void>(context.beam_search(result, start_state, config, lookups, &check));
+        check.start_checking();
+        static_cast<void>(context.beam_search(result, start_state, config, lookups, &check));
     }
-    auto end = std::chrono::steady_clock::now();
 
-    double elapsed = std::chrono::duration<double>(end - start).count();
-    std::cout << NetSize << ": " << (iterations / elapsed) << " calls/sec\n";
+    std::cout << "  steady_state_allocations n=" << NetSize << "   " << check.failed_levels() << " of "
+              << check.checked_levels() << " levels allocated\n" << check.report();
+    return check.failed_levels() == 0;
 }
 
+// Check that the memory estimate counts as many lookup tables as a search holds,
+// without and with pinning. Pinning also moves the calling thread (worker 0), so
+// its CPU affinity is restored afterwards. Returns false if the two disagree.
 template<int NetSize>
-void benchmark_do_random_transition(const Config& config, const LookupTables& lookups) {
-    State<NetSize> state(config);
-    state.set_start_state(config, lookups);
+bool check_lookup_copies(std::vector<std::string> args, const LookupTables& lookups) {
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    const bool saved = sched_getaffinity(0, sizeof(affinity), &affinity) == 0;
+
+    bool passed = true;
+    for (const bool pin : {false, true}) {
+        if (pin) args.push_back("--pin");
+        std::vector<char*> argv;
+        for (auto& arg : args) argv.push_back(arg.data());
+        Config config;
+        config.parse_args(static_cast<int>(argv.size()), argv.data());
+
+        const BeamSearchContext<NetSize> context(config, lookups);
+        const std::size_t held = context.num_lookup_tables();
+        const std::size_t estimated = count_lookup_copies(config.get_num_threads(), config.get_pin_threads());
+        std::cout << "  lookup_copies n=" << NetSize << (pin ? " pinned" : "") << "   " << held << " held, "
+                  << estimated << " estimated\n";
+        passed = passed && held == estimated;
+    }
 
-    // Warmup
-    for (int i = 0; i < 100; ++i) {
-        if (state.num_unsorted > 0) {
-            state.do_random_transition(lookups);
-        } else {
-            state.set_start_state(config, lookups);
+    if (saved) sched_setaffinity(0, sizeof(affinity), &affinity);
+    return passed;
+}
+
+// Run the search from start_state, a level at a time as beam_search() does,
+// until a level has more unique candidates than the beam holds. Returns that
+// level, with its candidates collected, or -1 if the search completes first.
+template<int NetSize>
+int advance_to_halving_level(BeamSearchContext<NetSize>& context, const State<NetSize>& start_state,
+                             const Config& config) {
+    context.current_beam_size = 1;
+    for (int level = 0; level < config.get_length_upper_bound(); ++level) {
+        context.beam_successors.clear();
+        context.candidates.clear();
+        if (context.collect_candidates_parallel(level, config.get_use_symmetry_heuristic(), start_state, config) != -1) {
+            return -1;
         }
+        if (context.candidates.size() > static_cast<std::size_t>(config.get_max_beam_size())) return level;
+
+        context.select_best_candidates(level, config.get_max_beam_size(), start_state, config);
+        context.rebuild_beam(level);
+    }
+    return -1;
+}
+
+// Time collection, deduplication, selection and rebuilding of one search level.
+template<int NetSize>
+void benchmark_level_kernels(const BenchmarkOptions& options, const Config& config, const LookupTables& lookups,
+                             const State<NetSize>& start_state, std::vector<BenchResult>& results) {
+    BeamSearchContext<NetSize> context(config, lookups);
+    int level;
+    {
+        SilenceOutput quiet;
+        level = advance_to_halving_level(context, start_state, config);
+    }
+    if (level < 0) {
+        std::cout << "  (level kernels skipped: the search completes before a level needs halving)\n";
+        return;
+    }
+    const int parent_beam_size = context.current_beam_size;
+    auto add = [&](const char* kernel, std::vector<double> samples) {
+        results.push_back(summarize_samples(kernel, NetSize, std::move(samples)));
+        print_result(results.back());
+    };
+
+    if (options.selected("dedup")) {
+        // The level's unique hashes, plus repeats of them up to the number of
+        // candidates generated, in random order
+        std::vector<std::uint64_t> hashes;
+        for (std::size_t i = 0; i < context.candidates.size(); ++i) hashes.push_back(context.candidates[i].canonical_hash);
+        std::mt19937 rng(NetSize);
+        while (hashes.size() < context.num_generated) hashes.push_back(hashes[rng() % context.candidates.size()]);
+        std::shuffle(hashes.begin(), hashes.end(), rng);
+
+        ConcurrentHashSet set;
+        set.reserve(hashes.size());
+        add("dedup", measure(options, [&] {
+            for (std::size_t i = 0; i < set.num_slots(); ++i) set.clear_slot(i);
+            std::size_t unique = 0;
+            for (std::uint64_t hash : hashes) unique += set.insert(hash) ? 1 : 0;
+            keep(unique);
+            return hashes.size();
+        }));
     }
 
-    state.set_start_state(config, lookups);
-    auto start = std::chrono::steady_clock::now();
-    for (int i = 0; i < iterations; ++i) {
-        if (state.num_unsorted > 0) {
-            state.do_random_transition(lookups);
-        } else {
-            state.set_start_state(config, lookups);
+    if (options.selected("collect_level")) {
+        add("collect_level", measure(options, [&] {
+            context.beam_successors.clear();
+            context.candidates.clear();
+        }, [&] {
+            keep(context.collect_candidates_parallel(level, config.get_use_symmetry_heuristic(), start_state, config));
+            return 1;
+        }));
+    }
+
+    // Selection prints the tests of each round
+    if (options.selected("select_level")) {
+        add("select_level", measure(options, [&] {
+            SilenceOutput quiet;
+            context.select_best_candidates(level, config.get_max_beam_size(), start_state, config);
+            return 1;
+        }));
+    }
+
+    if (options.selected("rebuild_beam")) {
+        if (context.beam_successors.empty()) {
+            SilenceOutput quiet;
+            context.select_best_candidates(level, config.get_max_beam_size(), start_state, config);
         }
+        // rebuild_beam() swaps the new level in; swap it back out before the next run
+        bool rebuilt = false;
+        add("rebuild_beam", measure(options, [&] {
+            if (rebuilt) context.beam.swap(context.temp_beam);
+            context.current_beam_size = parent_beam_size;
+        }, [&] {
+            context.rebuild_beam(level);
+            rebuilt = true;
+            return 1;
+        }));
     }
-    auto end = std::chrono::steady_clock::now();
+}
+
+// Memory needed to benchmark one size, to skip sizes that would not fit.
+inline std::size_t benchmark_memory_bytes(const BenchmarkOptions& options, const Config& config) {
+    const MemoryEstimate estimate = estimate_memory(config, config.get_max_beam_size(), 1);
+    const std::size_t kernels = estimate.lookup_tables() + 4 * estimate.state_bytes;
+    return config.get_net_size() <= options.max_level_size ? std::max(kernels, estimate.resident()) : kernels;
+}
 
-    double elapsed = std::chrono::duration<double>(end - start).count();
-    std::cout << NetSize << ": " << (iterations / elapsed) << " calls/sec\n";
+inline std::size_t physical_memory_bytes() {
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long page_size = sysconf(_SC_PAGESIZE);
+    return pages > 0 && page_size > 0 ? static_cast<std::size_t>(pages) * static_cast<std::size_t>(page_size) : 0;
 }
 
+// Returns false if a check failed.
 template<int NetSize>
-void run_benchmarks_for_size() {
+bool run_benchmarks_for_size(const BenchmarkOptions& options, std::vector<BenchResult>& results) {
+    std::vector<std::string> args = {"benchmark", "-n", std::to_string(NetSize),
+                                     "-b", std::to_string(options.beam_size),
+                                     "-t", std::to_string(options.num_tests),
+                                     "-T", std::to_string(options.num_threads)};
+    std::vector<char*> argv;
+    for (auto& arg : args) argv.push_back(arg.data());
     Config config;
-    std::string size_str = std::to_string(NetSize);
-    char size_buf[16];
-    std::copy(size_str.begin(), size_str.end(), size_buf);
-    size_buf[size_str.size()] = '\0';
+    config.parse_args(static_cast<int>(argv.size()), argv.data());
 
-    char* argv[] = {const_cast<char*>("benchmark"), const_cast<char*>("-n"), size_buf};
-    int argc = 3;
-    config.parse_args(argc, argv);
+    std::cout << "NetSize=" << NetSize << ":\n";
+    const std::size_t needed = benchmark_memory_bytes(options, config);
+    const std::size_t available = physical_memory_bytes();
+    if (available > 0 && needed > available) {
+        std::cout << "  skipped: needs about " << format_bytes(needed) << " of memory, "
+                  << format_bytes(available) << " installed\n\n";
+        return true;
+    }
 
     LookupTables lookups;
     lookups.initialize(config);
+    auto add = [&](const char* kernel, std::vector<double> samples) {
+        results.push_back(summarize_samples(kernel, NetSize, std::move(samples)));
+        print_result(results.back());
+    };
+
+    State<NetSize> start_state(config);
+    start_state.set_start_state(config, lookups);
+    State<NetSize> scratch(config);
+
+    std::vector<RandomNetwork> networks;
+    for (int i = 0; i < NUM_BENCH_NETWORKS; ++i) {
+        scratch = start_state;
+        while (scratch.num_unsorted > 0) scratch.do_random_transition(lookups);
+        networks.push_back({std::vector<Operation>(scratch.operations.begin(),
+                                                   scratch.operations.begin() + scratch.current_level),
+                            scratch.num_layers});
+    }
+    std::size_t next_network = 0;
+    auto network = [&]() -> const RandomNetwork& { return networks[next_network++ % networks.size()]; };
+
+    if (options.selected("lookup_initialize")) {
+        // Refills the existing tables in place, so page faults on first use are not included
+        add("lookup_initialize", measure(options, [&] {
+            lookups.initialize(config);
+            return 1;
+        }));
+    }
+
+    if (options.selected("canonical_hash")) {
+        add("canonical_hash", measure(options, [&] {
+            std::uint64_t hash = 0;
+            for (const RandomNetwork& net : networks) {
+                hash ^= compute_canonical_hash<NetSize>(net.operations, static_cast<int>(net.operations.size()));
+            }
+            keep(hash);
+            return networks.size();
+        }));
+    }
+
+    if (options.selected("find_successors")) {
+        // Halfway through a random network
+        State<NetSize> partial(config);
+        partial.set_start_state(config, lookups);
+        const RandomNetwork& net = networks.front();
+        partial.apply_operations(net.operations.data(), static_cast<int>(net.operations.size()) / 2, lookups);
+        typename State<NetSize>::SuccessorRows rows;
+        add("find_successors", measure(options, [&] {
+            for (int i = 0; i < FIND_SUCCESSORS_BATCH; ++i) keep(partial.find_successors(rows));
+            return FIND_SUCCESSORS_BATCH;
+        }));
+    }
+
+    if (options.selected("update_state")) {
+        // Replays a whole random network; the reset to the start state is not timed
+        const RandomNetwork* net = nullptr;
+        add("update_state", measure(options, [&] {
+            scratch = start_state;
+            net = &network();
+        }, [&] {
+            scratch.apply_operations(net->operations.data(), static_cast<int>(net->operations.size()), lookups);
+            return net->operations.size();
+        }));
+    }
+
+    if (options.selected("do_random_transition")) {
+        add("do_random_transition", measure(options, [&] { scratch = start_state; }, [&] {
+            std::size_t transitions = 0;
+            for (; scratch.num_unsorted > 0; ++transitions) scratch.do_random_transition(lookups);
+            return transitions;
+        }));
+    }
 
-    std::cout << "Benchmarking score_state for NetSize=" << NetSize << "...\n";
-    benchmark_score_state<NetSize>(config, lookups);
+    if (options.selected("score_state")) {
+        add("score_state", measure(options, [&] {
+            keep(start_state.score_state(config.get_num_scoring_iterations(), config.get_depth_weight(),
+                                         scratch, lookups));
+            return 1;
+        }));
+    }
 
-    std::cout << "Benchmarking update_state for NetSize=" << NetSize << "...\n";
-    benchmark_update_state<NetSize>(config, lookups);
+    if (options.selected("minimise_depth")) {
+        add("minimise_depth", measure(options, [&] {
+            const RandomNetwork& net = network();
+            std::copy(net.operations.begin(), net.operations.end(), scratch.operations.begin());
+            scratch.current_level = static_cast<int>(net.operations.size());
+            scratch.num_layers = net.num_layers;
+        }, [&] {
+            scratch.minimise_depth();
+            return 1;
+        }));
+    }
 
-    std::cout << "Benchmarking do_random_transition for NetSize=" << NetSize << "...\n";
-    benchmark_do_random_transition<NetSize>(config, lookups);
+    bool passed = true;
+    if (NetSize <= options.max_level_size) {
+        benchmark_level_kernels<NetSize>(options, config, lookups, start_state, results);
+        if (ALLOCATION_TRACKING && options.selected("steady_state_allocations")) {
+            passed = check_steady_state_allocations<NetSize>(config, lookups);
+        }
+        if (options.selected("lookup_copies")) {
+            passed = check_lookup_copies<NetSize>(args, lookups) && passed;
+        }
+    }
 
     std::cout << "\n";
+    return passed;
+}
+
+// Parse a list of sizes such as "8,10,12" or "4-24".
+inline std::vector<int> parse_sizes(const std::string& text) {
+    return parse_int_list(text, "--sizes", MIN_BENCH_SIZE, MAX_BENCH_SIZE);
+}
+
+void print_benchmark_usage(const char* program_name) {
+    const BenchmarkOptions defaults;
+    std::cout << "Usage: " << program_name << " [options]\n\n"
+              << "Options:\n"
+              << "  -n, --sizes LIST             Network sizes, e.g. 8,10,12 or 4-24 (default: "
+              << MIN_BENCH_SIZE << '-' << MAX_BENCH_SIZE << ")\n"
+              << "  -r, --repeats N              Timed repeats per kernel (default: " << defaults.repeats << ")\n"
+              << "      --min-time SECONDS       Minimum measured time per repeat (default: " << defaults.min_seconds << ")\n"
+              << "  -b, --beam-size SIZE         Beam width of the level kernels (default: " << defaults.beam_size << ")\n"
+              << "  -t, --scoring-tests N        Scoring tests per candidate (default: " << defaults.num_tests << ")\n"
+              << "  -T, --threads N              Worker threads, 0 = one per available CPU (default: "
+              << defaults.num_threads << ")\n"
+              << "  -L, --max-level-size SIZE    Largest size to run the level kernels, the lookup copy check\n"
+              << "                               and the steady-state allocation check for (default: "
+              << defaults.max_level_size << ")\n"
+              << "  -f, --filter TEXT            Only run kernels whose name contains TEXT\n"
+              << "  -j, --json FILE              Write the results to FILE as JSON\n"
+              << "  -c, --compare FILE           Compare with the results in FILE, written earlier by --json\n"
+              << "  -x, --threshold PERCENT      Slowdown that counts as a regression (default: "
+              << defaults.threshold * 100.0 << ")\n"
+              << "  -h, --help                   Show this help message\n"
+              << "\n"
+              << "Kernels: lookup_initialize, canonical_hash, find_successors, update_state,\n"
+              << "do_random_transition, score_state, minimise_depth, dedup, collect_level,\n"
+              << "select_level, rebuild_beam, lookup_copies, steady_state_allocations (make bench-alloc only)\n";
+}
+
+BenchmarkOptions parse_benchmark_args(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    options.sizes = parse_sizes(std::to_string(MIN_BENCH_SIZE) + '-' + std::to_string(MAX_BENCH_SIZE));
+
+    auto integer = [&](int& i, const char* name) {
+        try {
+            return std::stoi(argv[++i]);
+        } catch (const std::exception&) {
+            throw std::invalid_argument(std::string("Invalid value for ") + name);
+        }
+    };
+    auto real = [&](int& i, const char* name) {
+        try {
+            return std::stod(argv[++i]);
+        } catch (const std::exception&) {
+            throw std::invalid_argument(std::string("Invalid value for ") + name);
+        }
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            print_benchmark_usage(argv[0]);
+            std::exit(0);
+        }
+        else if ((arg == "-n" || arg == "--sizes") && i + 1 < argc) {
+            options.sizes = parse_sizes(argv[++i]);
+        }
+        else if ((arg == "-r" || arg == "--repeats") && i + 1 < argc) {
+            options.repeats = integer(i, "--repeats");
+        }
+        else if (arg == "--min-time" && i + 1 < argc) {
+            options.min_seconds = real(i, "--min-time");
+        }
+        else if ((arg == "-b" || arg == "--beam-size") && i + 1 < argc) {
+            options.beam_size = integer(i, "--beam-size");
+        }
+        else if ((arg == "-t" || arg == "--scoring-tests") && i + 1 < argc) {
+            options.num_tests = integer(i, "--scoring-tests");
+        }
+        else if ((arg == "-T" || arg == "--threads") && i + 1 < argc) {
+            options.num_threads = integer(i, "--threads");
+        }
+        else if ((arg == "-L" || arg == "--max-level-size") && i + 1 < argc) {
+            options.max_level_size = integer(i, "--max-level-size");
+        }
+        else if ((arg == "-f" || arg == "--filter") && i + 1 < argc) {
+            options.filter = argv[++i];
+        }
+        else if ((arg == "-j" || arg == "--json") && i + 1 < argc) {
+            options.json_file = argv[++i];
+        }
+        else if ((arg == "-c" || arg == "--compare") && i + 1 < argc) {
+            options.baseline_file = argv[++i];
+        }
+        else if ((arg == "-x" || arg == "--threshold") && i + 1 < argc) {
+            options.threshold = real(i, "--threshold") / 100.0;
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            print_benchmark_usage(argv[0]);
+            std::exit(1);
+        }
+    }
+
+    if (options.repeats < 2) {
+        throw std::invalid_argument("repeats must be at least 2 for a confidence interval");
+    }
+    if (options.min_seconds < 0.0) {
+        throw std::invalid_argument("min-time must not be negative");
+    }
+    if (options.threshold < 0.0) {
+        throw std::invalid_argument("threshold must not be negative");
+    }
+    return options;
+}
+
+bool run_benchmarks_for_size(int net_size, const BenchmarkOptions& options, std::vector<BenchResult>& results) {
+    switch (net_size) {
+        case 4: return run_benchmarks_for_size<4>(options, results);
+        case 5: return run_benchmarks_for_size<5>(options, results);
+        case 6: return run_benchmarks_for_size<6>(options, results);
+        case 7: return run_benchmarks_for_size<7>(options, results);
+        case 8: return run_benchmarks_for_size<8>(options, results);
+        case 9: return run_benchmarks_for_size<9>(options, results);
+        case 10: return run_benchmarks_for_size<10>(options, results);
+        case 11: return run_benchmarks_for_size<11>(options, results);
+        case 12: return run_benchmarks_for_size<12>(options, results);
+        case 13: return run_benchmarks_for_size<13>(options, results);
+        case 14: return run_benchmarks_for_size<14>(options, results);
+        case 15: return run_benchmarks_for_size<15>(options, results);
+        case 16: return run_benchmarks_for_size<16>(options, results);
+        case 17: return run_benchmarks_for_size<17>(options, results);
+        case 18: return run_benchmarks_for_size<18>(options, results);
+        case 19: return run_benchmarks_for_size<19>(options, results);
+        case 20: return run_benchmarks_for_size<20>(options, results);
+        case 21: return run_benchmarks_for_size<21>(options, results);
+        case 22: return run_benchmarks_for_size<22>(options, results);
+        case 23: return run_benchmarks_for_size<23>(options, results);
+        case 24: return run_benchmarks_for_size<24>(options, results);
+        default: return true;
+    }
 }
 
-int main() {
-    std::cout << "=== Sorting Network Performance Benchmarks ===\n\n";
+int main(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    Baseline baseline;
+    try {
+        options = parse_benchmark_args(argc, argv);
+        if (!options.baseline_file.empty()) baseline = load_baseline(options.baseline_file);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    std::cout << "=== Sorting Network Performance Benchmarks ===\n"
+              << "CPU_DISPATCH = " << cpu_dispatch_level() << ", " << options.repeats << " repeats of at least "
+              << options.min_seconds << " s each, mean time per operation +- 95% confidence interval\n\n";
 
-    run_benchmarks_for_size<8>();
-    run_benchmarks_for_size<10>();
-    run_benchmarks_for_size<12>();
+    std::vector<BenchResult> results;
+    bool passed = true;
+    try {
+        for (int net_size : options.sizes) {
+            passed = run_benchmarks_for_size(net_size, options, results) && passed;
+        }
+        if (!options.json_file.empty()) {
+            write_results_json(options.json_file, results, cpu_dispatch_level(),
+                               options.num_threads > 0 ? options.num_threads : default_thread_count(), options.repeats);
+            std::cout << "Results written to " << options.json_file << "\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
 
+    if (!passed) {
+        std::cout << "FAILED: steady-state search levels allocated memory.\n";
+        return 1;
+    }
+    if (!baseline.empty()) {
+        const int regressions = compare_to_baseline(results, baseline, options.threshold);
+        if (regressions > 0) {
+            std::cout << "FAILED: " << regressions << " kernel(s) slower than the baseline.\n";
+            return 1;
+        }
+    }
     std::cout << "Benchmarks completed.\n";
     return 0;
 }
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "types.h"
+#include "file_sync.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Checkpoints of a running search for --checkpoint, continued with --resume.
+//
+// A checkpoint holds everything needed to carry on where the search stopped:
+// the parameters it ran with, the iteration and the prefix it started from, the
+// beam of the level it was about to expand, every worker's random number
+// generator, and the best network of the iterations already finished. Between
+// iterations there is no beam, and a resumed run starts the next iteration.
+// The file is a small header followed by the arrays as raw records:
+//
+//   "SNCHECK1", net_size, max_beam_size, num_scoring_tests, use_symmetry,
+//   depth_weight, two_layer_prefixes, iteration, elapsed_seconds, level,
+//   beam_size, best_length, best_depth, num_prefix_ops, num_best_ops,
+//   num_rng_states, prefix operations, beam operations, best operations,
+//   then each generator state as its length and text
+//
+// It is written to a temporary file, synced and renamed into place (see
+// file_sync.h), so the previous checkpoint survives a crash or power loss
+// while the next one is being written.
+
+inline constexpr char CHECKPOINT_MAGIC[8] = {'S', 'N', 'C', 'H', 'E', 'C', 'K', '1'};
+
+struct SearchCheckpoint {
+    std::int32_t net_size = 0;
+    std::int32_t max_beam_size = 0;
+    std::int32_t num_scoring_tests = 0;
+    std::int32_t use_symmetry = 0;
+    double depth_weight = 0.0;
+    std::int32_t two_layer_prefixes = 0;
+    std::int32_t iteration = 0;             // Iterations started, including the one in progress
+    double elapsed_seconds = 0.0;           // Search time before this checkpoint
+    std::int32_t level = 0;                 // Operations in each beam entry
+    std::int32_t beam_size = 0;             // 0 = between iterations
+    std::int32_t best_length = 0;           // 0 = no iteration finished yet
+    std::int32_t best_depth = 0;
+    std::vector<Operation> prefix;          // Prefix the latest iteration started from
+    std::vector<Operation> beam;            // beam_size rows of level operations
+    std::vector<Operation> best;            // Best network of the finished iterations
+    std::vector<std::string> rng_states;    // One per worker
+
+    [[nodiscard]] const Operation* beam_entry(std::size_t i) const {
+        return beam.data() + i * static_cast<std::size_t>(level);
+    }
+};
+
+// Whether ops are the first ops.size() operations of other.
+inline bool starts_with_operations(const Operation* other, const std::vector<Operation>& ops) {
+    return std::equal(ops.begin(), ops.end(), other,
+                      [](const Operation& a, const Operation& b) { return a.op1 == b.op1 && a.op2 == b.op2; });
+}
+
+inline void write_checkpoint(const std::string& path, const SearchCheckpoint& checkpoint) {
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot open checkpoint file " + temp_path + ": " + std::strerror(errno));
+        }
+        auto put = [&](const auto& value) { out.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+        const std::int32_t num_prefix_ops = static_cast<std::int32_t>(checkpoint.prefix.size());
+        const std::int32_t num_best_ops = static_cast<std::int32_t>(checkpoint.best.size());
+        const std::int32_t num_rng_states = static_cast<std::int32_t>(checkpoint.rng_states.size());
+
+        out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        put(checkpoint.net_size);
+        put(checkpoint.max_beam_size);
+        put(checkpoint.num_scoring_tests);
+        put(checkpoint.use_symmetry);
+        put(checkpoint.depth_weight);
+        put(checkpoint.two_layer_prefixes);
+        put(checkpoint.iteration);
+        put(checkpoint.elapsed_seconds);
+        put(checkpoint.level);
+        put(checkpoint.beam_size);
+        put(checkpoint.best_length);
+        put(checkpoint.best_depth);
+        put(num_prefix_ops);
+        put(num_best_ops);
+        put(num_rng_states);
+        out.write(reinterpret_cast<const char*>(checkpoint.prefix.data()),
+                  static_cast<std::streamsize>(checkpoint.prefix.size() * sizeof(Operation)));
+        out.write(reinterpret_cast<const char*>(checkpoint.beam.data()),
+                  static_cast<std::streamsize>(checkpoint.beam.size() * sizeof(Operation)));
+        out.write(reinterpret_cast<const char*>(checkpoint.best.data()),
+                  static_cast<std::streamsize>(checkpoint.best.size() * sizeof(Operation)));
+        for (const std::string& state : checkpoint.rng_states) {
+            const std::uint32_t length = static_cast<std::uint32_t>(state.size());
+            put(length);
+            out.write(state.data(), static_cast<std::streamsize>(length));
+        }
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Cannot write checkpoint file " + temp_path + ": " + std::strerror(errno));
+        }
+    }
+    replace_file_durably(temp_path, path);
+}
+
+inline SearchCheckpoint read_checkpoint(const std::string& path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw std::runtime_error("Cannot open checkpoint file " + path + ": " + std::strerror(errno));
+    }
+    const std::uint64_t file_size = static_cast<std::uint64_t>(in.tellg());
+    in.seekg(0);
+    auto get = [&](auto& value) { in.read(reinterpret_cast<char*>(&value), sizeof(value)); };
+
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0) {
+        throw std::runtime_error(path + " is not a search checkpoint");
+    }
+
+    SearchCheckpoint checkpoint;
+    std::int32_t num_prefix_ops = 0;
+    std::int32_t num_best_ops = 0;
+    std::int32_t num_rng_states = 0;
+    get(checkpoint.net_size);
+    get(checkpoint.max_beam_size);
+    get(checkpoint.num_scoring_tests);
+    get(checkpoint.use_symmetry);
+    get(checkpoint.depth_weight);
+    get(checkpoint.two_layer_prefixes);
+    get(checkpoint.iteration);
+    get(checkpoint.elapsed_seconds);
+    get(checkpoint.level);
+    get(checkpoint.beam_size);
+    get(checkpoint.best_length);
+    get(checkpoint.best_depth);
+    get(num_prefix_ops);
+    get(num_best_ops);
+    get(num_rng_states);
+    if (!in || checkpoint.net_size < 2 || checkpoint.net_size > MAX_NET_SIZE || checkpoint.iteration < 1 ||
+        num_prefix_ops < 0 || checkpoint.level < 0 || checkpoint.beam_size < 0 ||
+        checkpoint.beam_size > checkpoint.max_beam_size || (checkpoint.beam_size > 0 && checkpoint.level < num_prefix_ops) ||
+        num_best_ops < 0 || num_rng_states < 0) {
+        throw std::runtime_error("Corrupt header in checkpoint file " + path);
+    }
+
+    // The arrays the header describes must fit in the rest of the file, which
+    // also keeps a corrupt header from asking for a huge allocation
+    const std::uint64_t num_ops = static_cast<std::uint64_t>(num_prefix_ops) + static_cast<std::uint64_t>(num_best_ops) +
+                                  static_cast<std::uint64_t>(checkpoint.beam_size) * static_cast<std::uint64_t>(checkpoint.level);
+    const std::uint64_t min_payload = num_ops * sizeof(Operation) +
+                                      static_cast<std::uint64_t>(num_rng_states) * sizeof(std::uint32_t);
+    if (min_payload > file_size - static_cast<std::uint64_t>(in.tellg())) {
+        throw std::runtime_error("Checkpoint file " + path + " is truncated");
+    }
+
+    checkpoint.prefix.resize(static_cast<std::size_t>(num_prefix_ops));
+    checkpoint.beam.resize(static_cast<std::size_t>(checkpoint.beam_size) * static_cast<std::size_t>(checkpoint.level));
+    checkpoint.best.resize(static_cast<std::size_t>(num_best_ops));
+    in.read(reinterpret_cast<char*>(checkpoint.prefix.data()),
+            static_cast<std::streamsize>(checkpoint.prefix.size() * sizeof(Operation)));
+    in.read(reinterpret_cast<char*>(checkpoint.beam.data()),
+            static_cast<std::streamsize>(checkpoint.beam.size() * sizeof(Operation)));
+    in.read(reinterpret_cast<char*>(checkpoint.best.data()),
+            static_cast<std::streamsize>(checkpoint.best.size() * sizeof(Operation)));
+    for (std::int32_t i = 0; i < num_rng_states && in; ++i) {
+        std::uint32_t length = 0;
+        get(length);
+        if (!in || length > file_size - static_cast<std::uint64_t>(in.tellg())) break;
+        std::string state(length, '\0');
+        in.read(state.data(), static_cast<std::streamsize>(length));
+        checkpoint.rng_states.push_back(std::move(state));
+    }
+    if (!in || checkpoint.rng_states.size() != static_cast<std::size_t>(num_rng_states)) {
+        throw std::runtime_error("Checkpoint file " + path + " is truncated");
+    }
+    if (static_cast<std::uint64_t>(in.tellg()) != file_size) {
+        throw std::runtime_error("Checkpoint file " + path + " has " +
+                                 std::to_string(file_size - static_cast<std::uint64_t>(in.tellg())) +
+                                 " unexpected bytes at the end");
+    }
+    return checkpoint;
+}
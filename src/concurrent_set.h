@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// ConcurrentHashSet is a fixed-capacity, insert-only set of 64-bit hashes that
+// many threads can insert into at once without locking.
+// It uses open addressing with linear probing; each slot is claimed with a single
+// compare-exchange, so an insert either claims an empty slot or finds the hash
+// already present.
+class ConcurrentHashSet {
+public:
+    // Make room for at least max_entries hashes, reallocating only if the table is
+    // too small. The table must then be cleared with clear_slot() before use.
+    void reserve(std::size_t max_entries) {
+        std::size_t capacity = 16;
+        while (capacity < max_entries * 2) {
+            capacity *= 2;
+        }
+        if (capacity > capacity_) {
+            slots_ = std::make_unique<std::atomic<std::uint64_t>[]>(capacity);
+            capacity_ = capacity;
+        }
+        mask_ = capacity - 1;
+    }
+
+    // Number of slots to clear, so callers can split clearing across threads.
+    [[nodiscard]] std::size_t num_slots() const { return mask_ + 1; }
+
+    void clear_slot(std::size_t i) { slots_[i].store(EMPTY, std::memory_order_relaxed); }
+
+    // Insert a hash. Returns true if it was not already present.
+    bool insert(std::uint64_t hash) {
+        if (hash == EMPTY) hash = EMPTY_REPLACEMENT;
+
+        for (std::size_t i = mix(hash) & mask_; ; i = (i + 1) & mask_) {
+            std::uint64_t current = slots_[i].load(std::memory_order_relaxed);
+            if (current == hash) return false;
+            if (current == EMPTY) {
+                if (slots_[i].compare_exchange_strong(current, hash, std::memory_order_relaxed)) {
+                    return true;
+                }
+                if (current == hash) return false;
+            }
+        }
+    }
+
+private:
+    static constexpr std::uint64_t EMPTY = 0;
+    static constexpr std::uint64_t EMPTY_REPLACEMENT = 0x9E3779B97F4A7C15ULL;
+
+    std::unique_ptr<std::atomic<std::uint64_t>[]> slots_;
+    std::size_t capacity_ = 0;
+    std::size_t mask_ = 0;
+
+    // FNV-1a output is already well mixed in its high bits; fold them down so
+    // the low bits used for indexing are too.
+    static std::size_t mix(std::uint64_t hash) {
+        return static_cast<std::size_t>(hash ^ (hash >> 32));
+    }
+};
@@ -1,7 +1,14 @@
 #include "config.h"
+#include "topology.h"
+#include "memory_budget.h"
+#include "probes.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 #include <cstdlib>
 #include <stdexcept>
+#include <unistd.h>
 
 void Config::initialize() {
     if (net_size_ < 2 || net_size_ > 32) {
@@ -33,6 +40,13 @@ void Config::initialize() {
         throw std::invalid_argument("max_iterations must be at least 1");
     }
 
+    if (num_threads_ < 0) {
+        throw std::invalid_argument("threads must be at least 1, or 0 for one per available CPU");
+    }
+    if (num_threads_ == 0) {
+        num_threads_ = default_thread_count();
+    }
+
     branching_factor_ = (net_size_ * (net_size_ - 1)) / 2;
     num_input_patterns_ = static_cast<std::size_t>(1ULL) << net_size_;
 
@@ -47,6 +61,156 @@ void Config::initialize() {
     length_lower_bound_ = bounds.length;
     length_upper_bound_ = length_lower_bound_ * 2;
     depth_lower_bound_ = bounds.depth;
+
+    if (!spill_dir_.empty() && access(spill_dir_.c_str(), W_OK | X_OK) != 0) {
+        throw std::invalid_argument("Spill directory " + spill_dir_ + " does not exist or is not writable");
+    }
+
+    if (!snapshot_levels_.empty()) {
+        if (snapshot_levels_.back() >= length_upper_bound_) {
+            throw std::invalid_argument("Snapshot levels must be below the length upper bound of " +
+                                        std::to_string(length_upper_bound_));
+        }
+        const std::string dir = snapshot_dir_.empty() ? "." : snapshot_dir_;
+        if (access(dir.c_str(), W_OK | X_OK) != 0) {
+            throw std::invalid_argument("Snapshot directory " + dir + " does not exist or is not writable");
+        }
+    }
+
+    if (use_two_layer_prefixes_ && !prefix_file_.empty()) {
+        throw std::invalid_argument("--prefix and --two-layer cannot be used together");
+    }
+
+    prefix_.clear();
+    if (!prefix_file_.empty()) {
+        load_prefix();
+    }
+
+    if (memory_budget_ > 0) {
+        fit_to_memory_budget();
+    }
+}
+
+void Config::fit_to_memory_budget() {
+    const std::size_t lookup_copies = count_lookup_copies(num_threads_, pin_threads_);
+    const std::size_t disk_bytes = spill_dir_.empty() ? 0 : free_disk_bytes(spill_dir_);
+
+    // Free disk space is only checked when it could be read
+    auto fits = [&](int beam_size) {
+        const MemoryEstimate estimate = estimate_memory(*this, beam_size, lookup_copies);
+        return estimate.resident() <= memory_budget_ && (disk_bytes == 0 || estimate.on_disk() <= disk_bytes);
+    };
+    auto describe = [&](int beam_size) {
+        const MemoryEstimate estimate = estimate_memory(*this, beam_size, lookup_copies);
+        std::string text = "an estimated " + format_bytes(estimate.resident()) + " of memory";
+        if (estimate.spilled) {
+            text += " and " + format_bytes(estimate.on_disk()) + " of disk (" + format_bytes(disk_bytes) + " free)";
+        }
+        return text + ", over the budget of " + format_bytes(memory_budget_);
+    };
+
+    if (beam_size_explicitly_set_) {
+        if (!fits(max_beam_size_)) {
+            throw std::invalid_argument("Beam width " + std::to_string(max_beam_size_) + " needs " + describe(max_beam_size_));
+        }
+        return;
+    }
+
+    if (!fits(1)) {
+        throw std::invalid_argument("Even a beam width of 1 needs " + describe(1));
+    }
+
+    beam_size_autosized_ = true;
+    if (fits(MAX_FITTED_BEAM_SIZE)) {
+        max_beam_size_ = MAX_FITTED_BEAM_SIZE;
+        beam_size_capped_ = true;
+        return;
+    }
+
+    // The estimate grows with the beam width, so binary search for the widest beam that fits
+    int low = 1;
+    int high = MAX_FITTED_BEAM_SIZE - 1;
+    while (low < high) {
+        const int mid = low + (high - low) / 2 + 1;
+        if (fits(mid)) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    max_beam_size_ = low;
+}
+
+void Config::parse_snapshot_levels(const std::string& text) {
+    snapshot_levels_.clear();
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        int first = 0;
+        int last = 0;
+        try {
+            const std::size_t dash = item.find('-');
+            first = std::stoi(item.substr(0, dash));
+            last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+        } catch (const std::exception&) {
+            throw std::invalid_argument("Invalid value for --snapshot-levels (expected e.g. 10,20 or 10-20)");
+        }
+        if (first < 0 || first > last) {
+            throw std::invalid_argument("Invalid level range " + item + " for --snapshot-levels");
+        }
+        for (int level = first; level <= last; ++level) snapshot_levels_.push_back(level);
+    }
+    std::sort(snapshot_levels_.begin(), snapshot_levels_.end());
+    snapshot_levels_.erase(std::unique(snapshot_levels_.begin(), snapshot_levels_.end()), snapshot_levels_.end());
+}
+
+// Read one comparator per line, written as "a b", "a,b" or "(a,b)".
+// The "+k:(a,b)" lines printed by this program are also accepted, so a previous
+// result can be fed straight back in; its "+Length"/"+Depth" lines are ignored.
+void Config::load_prefix() {
+    std::ifstream in(prefix_file_);
+    if (!in) {
+        throw std::invalid_argument("Cannot open prefix file " + prefix_file_);
+    }
+
+    std::string line;
+    for (int line_number = 1; std::getline(in, line); ++line_number) {
+        auto comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        if (!line.empty() && line[0] == '+') {
+            auto colon = line.find(":(");
+            if (colon == std::string::npos) continue;
+            line.erase(0, colon + 1);
+        }
+        std::replace_if(line.begin(), line.end(),
+                        [](char c) { return c == '(' || c == ')' || c == ','; }, ' ');
+
+        std::istringstream fields(line);
+        int a, b;
+        std::string rest;
+        if (!(fields >> a)) {
+            if (fields.eof()) continue;  // Blank line
+            throw std::invalid_argument("Malformed comparator on line " + std::to_string(line_number) +
+                                        " of " + prefix_file_);
+        }
+        if (!(fields >> b) || (fields >> rest)) {
+            throw std::invalid_argument("Malformed comparator on line " + std::to_string(line_number) +
+                                        " of " + prefix_file_);
+        }
+        if (a < 0 || b < 0 || a >= net_size_ || b >= net_size_ || a == b) {
+            throw std::invalid_argument("Invalid comparator (" + std::to_string(a) + "," + std::to_string(b) +
+                                        ") on line " + std::to_string(line_number) + " of " + prefix_file_);
+        }
+        if (a > b) std::swap(a, b);
+        prefix_.push_back(Operation{static_cast<std::uint8_t>(a), static_cast<std::uint8_t>(b)});
+    }
+
+    if (static_cast<int>(prefix_.size()) >= length_upper_bound_) {
+        throw std::invalid_argument("Prefix has " + std::to_string(prefix_.size()) +
+                                    " comparators, must be fewer than " + std::to_string(length_upper_bound_));
+    }
 }
 
 void Config::print_usage(const char* program_name) const {
@@ -62,13 +226,42 @@ void Config::print_usage(const char* program_name) const {
               << "  -S, --no-symmetry            Disable symmetry heuristic\n"
               << "                               (default: on for even net_size, off for odd)\n"
               << "  -w, --depth-weight W         Weight for depth vs length, 0.0-1.0 (default: " << depth_weight_ << ")\n"
+              << "  -p, --prefix FILE            Start every search from the comparators listed in FILE\n"
+              << "  -l, --two-layer              Fix layer 1 and search from each canonical second layer in turn,\n"
+              << "                               one per iteration\n"
+              << "      --seed N                 Seed the random rollouts, so a run with -T 1 can be repeated\n"
+              << "                               (default: 0 = seed from the system)\n"
+              << "  -T, --threads N              Worker threads, 0 = one per available CPU, respecting\n"
+              << "                               cgroup CPU quotas (default: " << num_threads_ << ")\n"
+              << "  -P, --pin                    Pin workers to CPUs and replicate lookup tables per NUMA node\n"
+              << "  -H, --huge-pages MODE        Back large pattern arrays with huge pages: off, thp or hugetlb\n"
+              << "                               (default: off)\n"
+              << "  -m, --memory-budget SIZE     Memory limit, e.g. 64G. Sizes the beam to fit unless -b is given,\n"
+              << "                               in which case the search fails fast if it would not fit\n"
+              << "  -d, --spill-dir DIR          Keep beams and candidates in files in DIR instead of memory,\n"
+              << "                               for beams too wide to fit in RAM\n"
+              << "  -M, --metrics FILE           Write one JSON record per search level to FILE (JSON Lines)\n"
+              << "  -C, --perf-counters          Count cycles, instructions, LLC, branch and dTLB misses per\n"
+              << "                               search phase (in --metrics records and a final summary)\n"
+              << "      --trace FILE             Write a timeline of worker tasks to FILE on exit\n"
+              << "                               (Chrome trace format, for Perfetto or chrome://tracing)\n"
+              << "      --snapshot-levels LIST   Save these levels (e.g. 10,20 or 10-20) for the replay benchmark\n"
+              << "      --snapshot-dir DIR       Directory for the snapshots (default: current directory)\n"
+              << "      --checkpoint FILE        Save the search to FILE at the end of a level, so it can be resumed\n"
+              << "      --checkpoint-interval S  Seconds between checkpoints (default: " << checkpoint_interval_ << ")\n"
+              << "      --resume FILE            Continue the search saved in FILE by --checkpoint\n"
               << "  -h, --help                   Show this help message\n"
               << "\n"
               << "Examples:\n"
               << "  " << program_name << " -n 8                    # Search for size-8 network\n"
               << "  " << program_name << " -n 12 -b 500 -t 5       # Search with larger beam\n"
               << "  " << program_name << " -n 17 -s                # Force symmetry for odd size\n"
-              << "  " << program_name << " -n 16 -S                # Disable symmetry for even size\n";
+              << "  " << program_name << " -n 16 -S                # Disable symmetry for even size\n"
+              << "  " << program_name << " -n 16 -p green16.txt    # Search onwards from a known prefix\n"
+              << "  " << program_name << " -n 12 -l -i 50          # Try the 50 most promising two-layer prefixes\n"
+              << "  " << program_name << " -n 20 -m 64G            # Widest beam that fits in 64 GiB\n"
+              << "  " << program_name << " -n 24 -b 1000000 -d /scratch  # Wide beam spilled to disk\n"
+              << "  " << program_name << " -n 16 -M levels.jsonl   # Record per-level timings and counts\n";
 }
 
 void Config::parse_args(int argc, char* argv[]) {
@@ -92,6 +285,7 @@ void Config::parse_args(int argc, char* argv[]) {
             } catch (const std::exception&) {
                 throw std::invalid_argument("Invalid value for --beam-size");
             }
+            beam_size_explicitly_set_ = true;
         }
         else if ((arg == "-t" || arg == "--scoring-tests") && i + 1 < argc) {
             try {
@@ -107,6 +301,81 @@ void Config::parse_args(int argc, char* argv[]) {
                 throw std::invalid_argument("Invalid value for --depth-weight");
             }
         }
+        else if (arg == "--seed" && i + 1 < argc) {
+            try {
+                seed_ = std::stoull(argv[++i]);
+            } catch (const std::exception&) {
+                throw std::invalid_argument("Invalid value for --seed");
+            }
+        }
+        else if ((arg == "-p" || arg == "--prefix") && i + 1 < argc) {
+            prefix_file_ = argv[++i];
+        }
+        else if ((arg == "-T" || arg == "--threads") && i + 1 < argc) {
+            try {
+                num_threads_ = std::stoi(argv[++i]);
+            } catch (const std::exception&) {
+                throw std::invalid_argument("Invalid value for --threads");
+            }
+        }
+        else if ((arg == "-H" || arg == "--huge-pages") && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "off") {
+                huge_page_mode_ = HugePageMode::Off;
+            } else if (mode == "thp") {
+                huge_page_mode_ = HugePageMode::Transparent;
+            } else if (mode == "hugetlb") {
+                huge_page_mode_ = HugePageMode::HugeTLB;
+            } else {
+                throw std::invalid_argument("Invalid value for --huge-pages (expected off, thp or hugetlb)");
+            }
+        }
+        else if ((arg == "-m" || arg == "--memory-budget") && i + 1 < argc) {
+            memory_budget_ = parse_byte_size(argv[++i]);
+            if (memory_budget_ == 0) {
+                throw std::invalid_argument("Invalid value for --memory-budget (expected a size such as 512M or 64G)");
+            }
+        }
+        else if ((arg == "-d" || arg == "--spill-dir") && i + 1 < argc) {
+            spill_dir_ = argv[++i];
+        }
+        else if ((arg == "-M" || arg == "--metrics") && i + 1 < argc) {
+            metrics_file_ = argv[++i];
+        }
+        else if (arg == "-C" || arg == "--perf-counters") {
+            perf_counters_ = true;
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            trace_file_ = argv[++i];
+        }
+        else if (arg == "--snapshot-levels" && i + 1 < argc) {
+            parse_snapshot_levels(argv[++i]);
+        }
+        else if (arg == "--snapshot-dir" && i + 1 < argc) {
+            snapshot_dir_ = argv[++i];
+        }
+        else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint_file_ = argv[++i];
+        }
+        else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+            try {
+                checkpoint_interval_ = std::stod(argv[++i]);
+            } catch (const std::exception&) {
+                throw std::invalid_argument("Invalid value for --checkpoint-interval");
+            }
+            if (checkpoint_interval_ < 0.0) {
+                throw std::invalid_argument("Checkpoint interval must not be negative");
+            }
+        }
+        else if (arg == "--resume" && i + 1 < argc) {
+            resume_file_ = argv[++i];
+        }
+        else if (arg == "-P" || arg == "--pin") {
+            pin_threads_ = true;
+        }
+        else if (arg == "-l" || arg == "--two-layer") {
+            use_two_layer_prefixes_ = true;
+        }
         else if (arg == "-s" || arg == "--symmetry") {
             use_symmetry_heuristic_ = true;
             symmetry_explicitly_set_ = true;
@@ -132,13 +401,60 @@ void Config::parse_args(int argc, char* argv[]) {
     initialize();
 }
 
+// Snapshot levels as given, e.g. "10,20-25", or "none".
+static std::string format_snapshot_levels(const std::vector<int>& levels) {
+    if (levels.empty()) return "none";
+    std::ostringstream text;
+    for (std::size_t i = 0; i < levels.size(); ) {
+        std::size_t j = i;
+        while (j + 1 < levels.size() && levels[j + 1] == levels[j] + 1) ++j;
+        text << (i > 0 ? "," : "") << levels[i];
+        if (j > i) text << '-' << levels[j];
+        i = j + 1;
+    }
+    return text.str();
+}
+
+const char* cpu_dispatch_level() {
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && !defined(NO_CPU_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("x86-64-v4")) return "x86-64-v4 (AVX-512)";
+    if (__builtin_cpu_supports("x86-64-v3")) return "x86-64-v3 (AVX2)";
+    if (__builtin_cpu_supports("x86-64-v2")) return "x86-64-v2 (SSE4.2)";
+    return "x86-64";
+#else
+    return "build target";
+#endif
+}
+
 void Config::print() const {
     std::cout << "MAX_ITERATIONS          = " << max_iterations_ << "\n"
               << "NET_SIZE                = " << net_size_ << "\n"
-              << "MAX_BEAM_SIZE           = " << max_beam_size_ << "\n"
+              << "MAX_BEAM_SIZE           = " << max_beam_size_ << (beam_size_capped_ ? " (capped, the memory budget allows more)" :
+                                                                      beam_size_autosized_ ? " (fitted to memory budget)" : "") << "\n"
               << "NUM_SCORING_TESTS       = " << num_scoring_iterations_ << "\n"
               << "USE_SYMMETRY_HEURISTIC  = " << (use_symmetry_heuristic_ ? "Yes" : "No") << "\n"
               << "DEPTH_WEIGHT            = " << depth_weight_ << "\n"
+              << "PREFIX_LENGTH           = " << prefix_.size() << "\n"
+              << "TWO_LAYER_PREFIXES      = " << (use_two_layer_prefixes_ ? "Yes" : "No") << "\n"
+              << "SEED                    = " << (seed_ == 0 ? std::string("random") : std::to_string(seed_)) << "\n"
+              << "NUM_THREADS             = " << num_threads_ << "\n"
+              << "PIN_THREADS             = " << (pin_threads_ ? "Yes" : "No") << "\n"
+              << "HUGE_PAGES              = " << (huge_page_mode_ == HugePageMode::Transparent ? "thp" :
+                                                  huge_page_mode_ == HugePageMode::HugeTLB ? "hugetlb" : "off") << "\n"
+              << "MEMORY_BUDGET           = " << (memory_budget_ == 0 ? "none" : format_bytes(memory_budget_)) << "\n"
+              << "SPILL_DIR               = " << (spill_dir_.empty() ? "none" : spill_dir_) << "\n"
+              << "METRICS_FILE            = " << (metrics_file_.empty() ? "none" : metrics_file_) << "\n"
+              << "PERF_COUNTERS           = " << (perf_counters_ ? "Yes" : "No") << "\n"
+              << "TRACE_FILE              = " << (trace_file_.empty() ? "none" : trace_file_) << "\n"
+              << "SNAPSHOT_LEVELS         = " << format_snapshot_levels(snapshot_levels_)
+              << (snapshot_levels_.empty() ? "" : " in " + (snapshot_dir_.empty() ? std::string(".") : snapshot_dir_)) << "\n"
+              << "CHECKPOINT              = " << (checkpoint_file_.empty() ? "none" : checkpoint_file_);
+    if (!checkpoint_file_.empty()) std::cout << " every " << checkpoint_interval_ << " s";
+    std::cout << "\n"
+              << "RESUME_FROM             = " << (resume_file_.empty() ? "none" : resume_file_) << "\n"
+              << "CPU_DISPATCH            = " << cpu_dispatch_level() << "\n"
+              << "USDT_PROBES             = " << (USDT_PROBES_ENABLED ? "Yes" : "No (built without sys/sdt.h)") << "\n"
               << "NUM_INPUT_PATTERNS      = " << num_input_patterns_ << "\n"
               << "INPUT_PATTERN_TYPE      = " << input_pattern_type_ << "\n"
               << "LENGTH_LOWER_BOUND      = " << length_lower_bound_ << "\n"
@@ -1,8 +1,10 @@
 #pragma once
 
+#include "types.h"
 #include <cstdint>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 struct Bounds {
     int length;
@@ -47,6 +49,10 @@ constexpr Bounds get_bounds(int n) {
     }
 }
 
+// Widest beam --memory-budget picks, however much memory it allows. A level of a
+// wider beam takes hours; an explicit -b can still go beyond it.
+inline constexpr int MAX_FITTED_BEAM_SIZE = 1 << 22;
+
 class Config {
 public:
     Config() = default;
@@ -63,6 +69,24 @@ public:
     [[nodiscard]] int get_num_scoring_iterations() const { return num_scoring_iterations_; }
     [[nodiscard]] bool get_use_symmetry_heuristic() const { return use_symmetry_heuristic_; }
     [[nodiscard]] double get_depth_weight() const { return depth_weight_; }
+    [[nodiscard]] const std::string& get_prefix_file() const { return prefix_file_; }
+    [[nodiscard]] const std::vector<Operation>& get_prefix() const { return prefix_; }
+    [[nodiscard]] bool get_use_two_layer_prefixes() const { return use_two_layer_prefixes_; }
+    [[nodiscard]] std::uint64_t get_seed() const { return seed_; }
+    [[nodiscard]] int get_num_threads() const { return num_threads_; }
+    [[nodiscard]] bool get_pin_threads() const { return pin_threads_; }
+    [[nodiscard]] HugePageMode get_huge_page_mode() const { return huge_page_mode_; }
+    [[nodiscard]] const std::string& get_spill_dir() const { return spill_dir_; }
+    [[nodiscard]] const std::string& get_metrics_file() const { return metrics_file_; }
+    [[nodiscard]] bool get_perf_counters() const { return perf_counters_; }
+    [[nodiscard]] const std::string& get_trace_file() const { return trace_file_; }
+    [[nodiscard]] const std::vector<int>& get_snapshot_levels() const { return snapshot_levels_; }
+    [[nodiscard]] const std::string& get_snapshot_dir() const { return snapshot_dir_; }
+    [[nodiscard]] const std::string& get_checkpoint_file() const { return checkpoint_file_; }
+    [[nodiscard]] double get_checkpoint_interval() const { return checkpoint_interval_; }
+    [[nodiscard]] const std::string& get_resume_file() const { return resume_file_; }
+    [[nodiscard]] std::size_t get_memory_budget() const { return memory_budget_; }
+    [[nodiscard]] bool get_beam_size_autosized() const { return beam_size_autosized_; }
 
     // Getters for computed parameters
     [[nodiscard]] std::size_t get_num_input_patterns() const { return num_input_patterns_; }
@@ -77,10 +101,27 @@ private:
     int max_iterations_ = 1;
     int net_size_ = 8;
     int max_beam_size_ = 100;
+    bool beam_size_explicitly_set_ = false;
     int num_scoring_iterations_ = 5;
     bool use_symmetry_heuristic_ = true;
     bool symmetry_explicitly_set_ = false;
     double depth_weight_ = 0.0001;
+    std::string prefix_file_;
+    bool use_two_layer_prefixes_ = false;
+    std::uint64_t seed_ = 0;  // 0 = seeded from the system
+    int num_threads_ = 0;  // 0 = one per allowed CPU, capped by the cgroup CPU quota
+    bool pin_threads_ = false;
+    HugePageMode huge_page_mode_ = HugePageMode::Off;
+    std::string spill_dir_;  // Empty = keep beams and candidates in memory
+    std::string metrics_file_;  // Empty = no per-level metrics
+    bool perf_counters_ = false;
+    std::string trace_file_;  // Empty = no timeline trace
+    std::vector<int> snapshot_levels_;  // Levels to save for replay
+    std::string snapshot_dir_;  // Empty = current directory
+    std::string checkpoint_file_;  // Empty = no checkpoints
+    double checkpoint_interval_ = 600.0;  // Seconds between checkpoints
+    std::string resume_file_;  // Empty = start a new search
+    std::size_t memory_budget_ = 0;  // Bytes, 0 = no budget
 
     // Computed parameters
     std::size_t num_input_patterns_ = 0;
@@ -89,4 +130,20 @@ private:
     int length_upper_bound_ = 0;
     int depth_lower_bound_ = 0;
     int branching_factor_ = 0;
+    bool beam_size_autosized_ = false;
+    bool beam_size_capped_ = false;   // The budget allowed more than MAX_FITTED_BEAM_SIZE
+    std::vector<Operation> prefix_;
+
+    // Parse a list of levels such as "10,20" or "10-20" into snapshot_levels_.
+    void parse_snapshot_levels(const std::string& text);
+
+    // Load the comparator list named by prefix_file_ into prefix_.
+    void load_prefix();
+
+    // Check the estimated memory use against memory_budget_, choosing the widest
+    // beam that fits unless one was given.
+    void fit_to_memory_budget();
 };
+
+// ISA level the HOT_KERNEL functions dispatch to on this CPU.
+const char* cpu_dispatch_level();
@@ -0,0 +1,290 @@
+#include "config.h"
+#include "lookup.h"
+#include "state.h"
+#include "search.h"
+#include "metrics.h"
+#include "bench_stats.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+// End-to-end benchmark: runs whole searches over a matrix of parameters and
+// records how quickly each finds a network and how good it is.
+//
+// Every combination of size, beam size, scoring tests, threads and seed is one
+// run of up to --iterations searches, stopped early once a network of the known
+// best length (get_bounds) is found or --time-limit is exceeded. Each finished
+// search is one CSV row with the elapsed wall and CPU time, the network found and
+// the best so far, and the rollouts run, for plotting quality against time. A
+// summary per run gives the time to the first network and to the bound, and the
+// rollout throughput.
+//
+// Runs use --seed, so a run with one thread can be repeated exactly. With more
+// threads the order in which workers take tasks still varies between runs.
+
+struct E2EOptions {
+    std::vector<int> sizes{8};
+    std::vector<int> beam_sizes{100};
+    std::vector<int> test_counts{5};
+    std::vector<int> thread_counts{0};
+    std::vector<int> seeds{1};
+    int iterations = 1;
+    double time_limit = 0.0;        // Seconds per run, 0 = none
+    std::string csv_file = "e2e.csv";
+    std::vector<std::string> search_args;  // Passed on to every search, e.g. -w 0.5
+};
+
+struct E2ERun {
+    int net_size = 0;
+    int beam_size = 0;
+    int tests = 0;
+    int threads = 0;
+    int seed = 0;
+};
+
+// Sums the rollouts of every level searched.
+class RolloutCounter : public LevelObserver {
+public:
+    void on_level(const LevelMetrics& metrics) override { rollouts += metrics.work.rollouts; }
+
+    std::uint64_t rollouts = 0;
+};
+
+// User and system CPU time of the process so far, in seconds.
+inline double process_cpu_seconds() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+    auto seconds = [](const timeval& time) { return static_cast<double>(time.tv_sec) + time.tv_usec * 1e-6; };
+    return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+inline void write_csv_header(std::ostream& csv) {
+    csv << "n,beam,tests,threads,seed,iteration,elapsed_s,cpu_s,length,depth,best_length,best_depth,"
+           "bound_length,bound_depth,rollouts,rollouts_per_s\n";
+}
+
+template<int NetSize>
+void run_e2e(const E2EOptions& options, const E2ERun& run, std::ostream& csv) {
+    std::vector<std::string> args = {"e2e_benchmark", "-n", std::to_string(NetSize),
+                                     "-b", std::to_string(run.beam_size),
+                                     "-t", std::to_string(run.tests),
+                                     "-T", std::to_string(run.threads),
+                                     "--seed", std::to_string(run.seed)};
+    args.insert(args.end(), options.search_args.begin(), options.search_args.end());
+    std::vector<char*> argv;
+    for (auto& arg : args) argv.push_back(arg.data());
+    Config config;
+    config.parse_args(static_cast<int>(argv.size()), argv.data());
+
+    // Setup (lookup tables, worker arenas) counts towards the time to a network
+    const auto start = std::chrono::steady_clock::now();
+    const double start_cpu = process_cpu_seconds();
+
+    LookupTables lookups;
+    lookups.initialize(config);
+    BeamSearchContext<NetSize> context(config, lookups);
+    State<NetSize> start_state(config);
+    start_state.set_start_state(config, lookups);
+    for (const auto& op : config.get_prefix()) start_state.update_state(op.op1, op.op2, lookups);
+
+    RolloutCounter rollouts;
+    int best_length = 0;
+    int best_depth = 0;
+    double first_seconds = 0.0;
+    double bound_seconds = -1.0;
+    double elapsed = 0.0;
+    double cpu = 0.0;
+    int iteration = 0;
+    while (iteration < options.iterations) {
+        ++iteration;
+        State<NetSize> result(config);
+        int length = 0;
+        {
+            SilenceOutput quiet;  // The search reports every level
+            length = context.beam_search(result, start_state, config, lookups, &rollouts);
+        }
+        result.minimise_depth();
+        const int depth = result.get_depth();
+        elapsed = seconds_since(start);
+        cpu = process_cpu_seconds() - start_cpu;
+
+        if (iteration == 1) first_seconds = elapsed;
+        if (iteration == 1 || length < best_length || (length == best_length && depth < best_depth)) {
+            best_length = length;
+            best_depth = depth;
+        }
+        csv << NetSize << ',' << run.beam_size << ',' << run.tests << ',' << config.get_num_threads() << ','
+            << run.seed << ',' << iteration << ',' << elapsed << ',' << cpu << ',' << length << ',' << depth << ','
+            << best_length << ',' << best_depth << ',' << config.get_length_lower_bound() << ','
+            << config.get_depth_lower_bound() << ',' << rollouts.rollouts << ','
+            << static_cast<double>(rollouts.rollouts) / elapsed << '\n';
+        csv.flush();
+
+        if (best_length <= config.get_length_lower_bound()) {
+            bound_seconds = elapsed;
+            break;
+        }
+        if (options.time_limit > 0.0 && elapsed >= options.time_limit) break;
+    }
+
+    char bound[32] = "-";
+    if (bound_seconds >= 0.0) std::snprintf(bound, sizeof(bound), "%.3f s", bound_seconds);
+    char line[192];
+    std::snprintf(line, sizeof(line),
+                  "  n=%-3d b=%-6d t=%-3d T=%-3d seed=%-4d first %9.3f s  bound %11s  best %d/%d  %.3g rollouts/s"
+                  "  (%d searches)\n",
+                  NetSize, run.beam_size, run.tests, config.get_num_threads(), run.seed, first_seconds, bound,
+                  best_length, best_depth, static_cast<double>(rollouts.rollouts) / elapsed, iteration);
+    std::cout << line << std::flush;
+}
+
+void run_e2e(const E2EOptions& options, const E2ERun& run, std::ostream& csv) {
+    switch (run.net_size) {
+        case 2: run_e2e<2>(options, run, csv); break;
+        case 3: run_e2e<3>(options, run, csv); break;
+        case 4: run_e2e<4>(options, run, csv); break;
+        case 5: run_e2e<5>(options, run, csv); break;
+        case 6: run_e2e<6>(options, run, csv); break;
+        case 7: run_e2e<7>(options, run, csv); break;
+        case 8: run_e2e<8>(options, run, csv); break;
+        case 9: run_e2e<9>(options, run, csv); break;
+        case 10: run_e2e<10>(options, run, csv); break;
+        case 11: run_e2e<11>(options, run, csv); break;
+        case 12: run_e2e<12>(options, run, csv); break;
+        case 13: run_e2e<13>(options, run, csv); break;
+        case 14: run_e2e<14>(options, run, csv); break;
+        case 15: run_e2e<15>(options, run, csv); break;
+        case 16: run_e2e<16>(options, run, csv); break;
+        case 17: run_e2e<17>(options, run, csv); break;
+        case 18: run_e2e<18>(options, run, csv); break;
+        case 19: run_e2e<19>(options, run, csv); break;
+        case 20: run_e2e<20>(options, run, csv); break;
+        case 21: run_e2e<21>(options, run, csv); break;
+        case 22: run_e2e<22>(options, run, csv); break;
+        case 23: run_e2e<23>(options, run, csv); break;
+        case 24: run_e2e<24>(options, run, csv); break;
+        case 25: run_e2e<25>(options, run, csv); break;
+        case 26: run_e2e<26>(options, run, csv); break;
+        case 27: run_e2e<27>(options, run, csv); break;
+        case 28: run_e2e<28>(options, run, csv); break;
+        case 29: run_e2e<29>(options, run, csv); break;
+        case 30: run_e2e<30>(options, run, csv); break;
+        case 31: run_e2e<31>(options, run, csv); break;
+        case 32: run_e2e<32>(options, run, csv); break;
+        default: throw std::invalid_argument("Unsupported net_size");
+    }
+}
+
+void print_e2e_usage(const char* program_name) {
+    const E2EOptions defaults;
+    std::cout << "Usage: " << program_name << " [options] [-- search options]\n\n"
+              << "Runs whole searches for every combination of the lists below (e.g. 8,10 or 1-5).\n"
+              << "Options after -- are passed on to every search, e.g. -- -w 0.5 -e 2.\n\n"
+              << "Options:\n"
+              << "  -n, --sizes LIST             Network sizes (default: 8)\n"
+              << "  -b, --beam-sizes LIST        Beam sizes (default: 100)\n"
+              << "  -t, --tests LIST             Scoring tests (default: 5)\n"
+              << "  -T, --threads LIST           Worker threads, 0 = one per available CPU (default: 0)\n"
+              << "  -s, --seeds LIST             Random seeds, one run each (default: 1)\n"
+              << "  -i, --iterations N           Searches per run (default: " << defaults.iterations << ")\n"
+              << "      --time-limit SECONDS     Start no new search after this long, 0 = no limit (default: 0)\n"
+              << "  -o, --csv FILE               Write one row per search to FILE (default: " << defaults.csv_file
+              << ")\n"
+              << "  -h, --help                   Show this help message\n";
+}
+
+E2EOptions parse_e2e_args(int argc, char* argv[]) {
+    E2EOptions options;
+    int i = 1;
+    for (; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            print_e2e_usage(argv[0]);
+            std::exit(0);
+        }
+        else if (arg == "--") {
+            options.search_args.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        else if ((arg == "-n" || arg == "--sizes") && i + 1 < argc) {
+            options.sizes = parse_int_list(argv[++i], "--sizes", 2, MAX_NET_SIZE);
+        }
+        else if ((arg == "-b" || arg == "--beam-sizes") && i + 1 < argc) {
+            options.beam_sizes = parse_int_list(argv[++i], "--beam-sizes", 1, std::numeric_limits<int>::max());
+        }
+        else if ((arg == "-t" || arg == "--tests") && i + 1 < argc) {
+            options.test_counts = parse_int_list(argv[++i], "--tests", 1, std::numeric_limits<int>::max());
+        }
+        else if ((arg == "-T" || arg == "--threads") && i + 1 < argc) {
+            options.thread_counts = parse_int_list(argv[++i], "--threads", 0, std::numeric_limits<int>::max());
+        }
+        else if ((arg == "-s" || arg == "--seeds") && i + 1 < argc) {
+            options.seeds = parse_int_list(argv[++i], "--seeds", 1, std::numeric_limits<int>::max());
+        }
+        else if ((arg == "-i" || arg == "--iterations") && i + 1 < argc) {
+            try {
+                options.iterations = std::stoi(argv[++i]);
+            } catch (const std::exception&) {
+                throw std::invalid_argument("Invalid value for --iterations");
+            }
+        }
+        else if (arg == "--time-limit" && i + 1 < argc) {
+            try {
+                options.time_limit = std::stod(argv[++i]);
+            } catch (const std::exception&) {
+                throw std::invalid_argument("Invalid value for --time-limit");
+            }
+        }
+        else if ((arg == "-o" || arg == "--csv") && i + 1 < argc) {
+            options.csv_file = argv[++i];
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            print_e2e_usage(argv[0]);
+            std::exit(1);
+        }
+    }
+    if (options.iterations < 1) {
+        throw std::invalid_argument("iterations must be at least 1");
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        const E2EOptions options = parse_e2e_args(argc, argv);
+        std::ofstream csv(options.csv_file, std::ios::out | std::ios::trunc);
+        if (!csv) {
+            throw std::runtime_error("Cannot open " + options.csv_file + ": " + std::strerror(errno));
+        }
+        csv.precision(9);
+        write_csv_header(csv);
+
+        std::cout << "End-to-end search benchmark (CPU dispatch: " << cpu_dispatch_level() << ")\n";
+        for (int n : options.sizes) {
+            for (int beam_size : options.beam_sizes) {
+                for (int tests : options.test_counts) {
+                    for (int threads : options.thread_counts) {
+                        for (int seed : options.seeds) {
+                            run_e2e(options, E2ERun{n, beam_size, tests, threads, seed}, csv);
+                        }
+                    }
+                }
+            }
+        }
+        std::cout << "Results written to " << options.csv_file << "\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
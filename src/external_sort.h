@@ -0,0 +1,67 @@
+#pragma once
+
+#include "worker_pool.h"
+#include <algorithm>
+#include <cstddef>
+#include <queue>
+#include <utility>
+#include <vector>
+
+// External-memory sort for record arrays that may not fit in RAM (see spill.h).
+//
+// The input is first sorted in place in runs of run_size records, in parallel on
+// the worker pool, with each run small enough to sort in RAM. The runs are then
+// merged with a k-way heap merge. The merge streams sequentially through every
+// run and through the output, so its working set is a few pages per run, however
+// large the arrays are.
+
+// Sort data[0, n) by less into out, writing at most limit records. If a record
+// compares equal under same to the previous record written, it is dropped, so
+// sorting with a key-equality predicate deduplicates on that key. Pass a
+// predicate that is always false to keep every record.
+// Returns the number of records written. data is left sorted run by run.
+template<typename T, typename Less, typename Same>
+std::size_t sort_merge(WorkerPool& pool, T* data, std::size_t n, T* out, std::size_t limit,
+                       std::size_t run_size, Less less, Same same) {
+    if (n == 0 || limit == 0) return 0;
+    run_size = std::max<std::size_t>(run_size, 1);
+    const std::size_t num_runs = (n + run_size - 1) / run_size;
+
+    pool.parallel_for(num_runs, 1, [&](int, std::size_t run) {
+        std::sort(data + run * run_size, data + std::min(n, (run + 1) * run_size), less);
+    });
+
+    std::size_t written = 0;
+    auto emit = [&](const T& record) {
+        if (written > 0 && same(out[written - 1], record)) return;
+        out[written++] = record;
+    };
+
+    if (num_runs == 1) {
+        for (std::size_t i = 0; i < n && written < limit; ++i) emit(data[i]);
+        return written;
+    }
+
+    // Heap of (next position, end) of every unfinished run, smallest record on
+    // top; ties go to the earlier run so the merge is stable across runs
+    using Cursor = std::pair<std::size_t, std::size_t>;
+    auto after = [&](const Cursor& a, const Cursor& b) {
+        if (less(data[b.first], data[a.first])) return true;
+        if (less(data[a.first], data[b.first])) return false;
+        return a.first > b.first;
+    };
+    std::vector<Cursor> cursors;
+    cursors.reserve(num_runs);
+    for (std::size_t run = 0; run < num_runs; ++run) {
+        cursors.emplace_back(run * run_size, std::min(n, (run + 1) * run_size));
+    }
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(after)> heap(after, std::move(cursors));
+
+    while (!heap.empty() && written < limit) {
+        Cursor cursor = heap.top();
+        heap.pop();
+        emit(data[cursor.first]);
+        if (++cursor.first < cursor.second) heap.push(cursor);
+    }
+    return written;
+}
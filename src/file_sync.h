@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Replace path with temp_path, which has been written and closed, so that after
+// a crash or power loss path holds either the old file or all of the new one.
+// The data is flushed to disk before the rename, and the directory after it, so
+// the rename cannot reach the disk ahead of the data it points to.
+inline void replace_file_durably(const std::string& temp_path, const std::string& path) {
+    const int fd = ::open(temp_path.c_str(), O_RDONLY);
+    if (fd < 0 || ::fsync(fd) != 0) {
+        const int error = errno;
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("Cannot sync " + temp_path + ": " + std::strerror(error));
+    }
+    ::close(fd);
+
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot rename " + temp_path + " to " + path + ": " + std::strerror(errno));
+    }
+
+    const std::size_t slash = path.find_last_of('/');
+    const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    const int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0 || ::fsync(dir_fd) != 0) {
+        const int error = errno;
+        if (dir_fd >= 0) ::close(dir_fd);
+        throw std::runtime_error("Cannot sync directory " + dir + ": " + std::strerror(error));
+    }
+    ::close(dir_fd);
+}
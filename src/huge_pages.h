@@ -0,0 +1,180 @@
+#pragma once
+
+#include "types.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+#include <sys/mman.h>
+
+// Huge-page backed allocation for the large pattern arrays.
+//
+// For n >= 18 the lookup tables and State::unsorted_patterns span hundreds of MB,
+// and the random accesses of update_state() and do_random_transition() thrash the
+// TLB with 4 KB pages. Unless the mode is Off, allocations of at least
+// HUGE_PAGE_THRESHOLD bytes are mapped directly with mmap and either advised for
+// transparent huge pages (MADV_HUGEPAGE) or backed by hugetlbfs pages (1 GB, then
+// 2 MB, falling back to transparent huge pages if none are reserved).
+// All other allocations go through operator new as usual.
+
+inline constexpr std::size_t HUGE_PAGE_SIZE = std::size_t{2} << 20;
+inline constexpr std::size_t GIGANTIC_PAGE_SIZE = std::size_t{1} << 30;
+inline constexpr std::size_t HUGE_PAGE_THRESHOLD = HUGE_PAGE_SIZE;
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+// Process-wide registry of the large mappings, so they can be unmapped with the
+// size they were mapped with and their huge-page backing can be reported.
+class HugePageRegistry {
+public:
+    static HugePageRegistry& instance() {
+        static HugePageRegistry registry;
+        return registry;
+    }
+
+    // Must be set before any large allocation is made.
+    void set_mode(HugePageMode mode) { mode_ = mode; }
+    [[nodiscard]] HugePageMode mode() const { return mode_; }
+
+    void* allocate(std::size_t bytes) {
+        void* ptr = MAP_FAILED;
+        std::size_t mapped = 0;
+        bool hugetlb = false;
+
+        if (mode_ == HugePageMode::HugeTLB) {
+            if (bytes >= GIGANTIC_PAGE_SIZE) {
+                mapped = round_up(bytes, GIGANTIC_PAGE_SIZE);
+                ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+            }
+            if (ptr == MAP_FAILED) {
+                mapped = round_up(bytes, HUGE_PAGE_SIZE);
+                ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+            }
+            hugetlb = (ptr != MAP_FAILED);
+        }
+
+        if (ptr == MAP_FAILED) {
+            mapped = round_up(bytes, HUGE_PAGE_SIZE);
+            ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED) throw std::bad_alloc();
+            madvise(ptr, mapped, MADV_HUGEPAGE);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        mappings_[ptr] = Mapping{mapped, hugetlb};
+        return ptr;
+    }
+
+    // Unmap a block from allocate(). Returns false if ptr was not mapped here.
+    bool deallocate(void* ptr) {
+        std::size_t mapped = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = mappings_.find(ptr);
+            if (it == mappings_.end()) return false;
+            mapped = it->second.bytes;
+            mappings_.erase(it);
+        }
+        munmap(ptr, mapped);
+        return true;
+    }
+
+    // Bytes currently mapped for large allocations, and how many of them are
+    // backed by huge pages (hugetlbfs mappings, plus AnonHugePages from smaps).
+    void usage(std::size_t& total_bytes, std::size_t& huge_bytes) {
+        std::unordered_map<std::uintptr_t, Mapping> mappings;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& [ptr, mapping] : mappings_) {
+                mappings[reinterpret_cast<std::uintptr_t>(ptr)] = mapping;
+            }
+        }
+
+        total_bytes = 0;
+        huge_bytes = 0;
+        for (const auto& [start, mapping] : mappings) {
+            total_bytes += mapping.bytes;
+            if (mapping.hugetlb) huge_bytes += mapping.bytes;
+        }
+
+        // smaps lists each mapping as "start-end perms ...", followed by its fields
+        std::ifstream smaps("/proc/self/smaps");
+        std::string line;
+        bool tracked = false;
+        while (std::getline(smaps, line)) {
+            if (!line.empty() && std::isxdigit(static_cast<unsigned char>(line[0])) && line.find('-') != std::string::npos) {
+                std::uintptr_t start = std::stoull(line.substr(0, line.find('-')), nullptr, 16);
+                auto it = mappings.find(start);
+                tracked = (it != mappings.end() && !it->second.hugetlb);
+            } else if (tracked && line.rfind("AnonHugePages:", 0) == 0) {
+                std::istringstream fields(line.substr(14));
+                std::size_t kb = 0;
+                fields >> kb;
+                huge_bytes += kb * 1024;
+            }
+        }
+    }
+
+private:
+    struct Mapping {
+        std::size_t bytes;
+        bool hugetlb;
+    };
+
+    HugePageMode mode_ = HugePageMode::Off;
+    std::mutex mutex_;
+    std::unordered_map<void*, Mapping> mappings_;
+
+    static std::size_t round_up(std::size_t bytes, std::size_t page) {
+        return (bytes + page - 1) / page * page;
+    }
+};
+
+// Standard allocator that maps large arrays through HugePageRegistry.
+template<typename T>
+struct HugePageAllocator {
+    using value_type = T;
+
+    HugePageAllocator() noexcept = default;
+    template<typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        const std::size_t bytes = n * sizeof(T);
+        auto& registry = HugePageRegistry::instance();
+        if (bytes >= HUGE_PAGE_THRESHOLD && registry.mode() != HugePageMode::Off) {
+            return static_cast<T*>(registry.allocate(bytes));
+        }
+        return static_cast<T*>(::operator new(bytes));
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        if (n * sizeof(T) >= HUGE_PAGE_THRESHOLD && HugePageRegistry::instance().deallocate(ptr)) {
+            return;
+        }
+        ::operator delete(ptr);
+    }
+
+    template<typename U>
+    bool operator==(const HugePageAllocator<U>&) const noexcept { return true; }
+};
+
+template<typename T>
+using HugePageVector = std::vector<T, HugePageAllocator<T>>;
@@ -2,7 +2,9 @@
 
 #include "config.h"
 #include "types.h"
+#include "huge_pages.h"
 #include <vector>
+#include <span>
 #include <cstdint>
 
 // LookupTables precomputes information about all possible input patterns
@@ -18,7 +20,7 @@ public:
         const std::size_t num_patterns = config.get_num_input_patterns();
 
         is_sorted_.resize(num_patterns);
-        allowed_ops_.resize(num_patterns);
+        allowed_offsets_.resize(num_patterns + 1);
 
         // Determine which input patterns are already sorted.
         // A pattern is sorted if all 0s come before all 1s (e.g., 0001111).
@@ -29,12 +31,26 @@ public:
         // For each unsorted pattern, precompute all valid compare-exchange operations.
         // An operation (i,j) is valid if the pattern has 0 at position i and 1 at position j.
         // This means applying the comparator would change the pattern.
+        // The lists are stored back to back: first count them to find each list's
+        // offset, then fill them in.
+        allowed_offsets_[0] = 0;
         for (std::size_t i = 0; i < num_patterns; ++i) {
-            allowed_ops_[i].clear();
+            std::uint64_t count = 0;
+            for (int n1 = 0; n1 < n - 1; ++n1) {
+                if (((i >> n1) & 1) == 0) {
+                    count += static_cast<std::uint64_t>(__builtin_popcountll(i >> (n1 + 1)));
+                }
+            }
+            allowed_offsets_[i + 1] = allowed_offsets_[i] + count;
+        }
+
+        allowed_ops_.resize(allowed_offsets_[num_patterns]);
+        for (std::size_t i = 0; i < num_patterns; ++i) {
+            std::uint64_t k = allowed_offsets_[i];
             for (int n1 = 0; n1 < n - 1; ++n1) {
                 for (int n2 = n1 + 1; n2 < n; ++n2) {
                     if (((static_cast<int>(i) >> n1) & 1) == 0 && ((static_cast<int>(i) >> n2) & 1) == 1) {
-                        allowed_ops_[i].push_back(Operation{static_cast<std::uint8_t>(n1), static_cast<std::uint8_t>(n2)});
+                        allowed_ops_[k++] = Operation{static_cast<std::uint8_t>(n1), static_cast<std::uint8_t>(n2)};
                     }
                 }
             }
@@ -46,22 +62,25 @@ public:
 
     // Get the list of valid compare-exchange operations for a pattern.
     // These are operations that would change the pattern (have 0 at op1, 1 at op2).
-    [[nodiscard]] const std::vector<Operation>& allowed_ops(int pattern) const {
-        return allowed_ops_[pattern];
+    [[nodiscard]] std::span<const Operation> allowed_ops(int pattern) const {
+        return {allowed_ops_.data() + allowed_offsets_[pattern],
+                static_cast<std::size_t>(allowed_offsets_[pattern + 1] - allowed_offsets_[pattern])};
     }
 
     // Get the number of valid operations for a pattern.
     [[nodiscard]] int num_allowed_ops(int pattern) const {
-        return static_cast<int>(allowed_ops_[pattern].size());
+        return static_cast<int>(allowed_offsets_[pattern + 1] - allowed_offsets_[pattern]);
     }
 
 private:
     // Bitmask indicating which patterns are already sorted.
-    std::vector<std::uint8_t> is_sorted_;
+    HugePageVector<std::uint8_t> is_sorted_;
 
-    // For each pattern, stores the list of valid compare-exchange operations.
+    // Valid compare-exchange operations of every pattern, stored back to back.
+    // Pattern p's operations are allowed_ops_[allowed_offsets_[p] .. allowed_offsets_[p + 1]).
     // An operation is valid if it would actually change the pattern.
-    std::vector<std::vector<Operation>> allowed_ops_;
+    HugePageVector<std::uint64_t> allowed_offsets_;
+    HugePageVector<Operation> allowed_ops_;
 
     // Check if a binary pattern represents a sorted sequence.
     // A pattern is sorted if all 0s appear before all 1s.
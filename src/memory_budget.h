@@ -0,0 +1,163 @@
+#pragma once
+
+#include "config.h"
+#include "types.h"
+#include "topology.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/statvfs.h>
+
+// Memory footprint of a search, estimated from its parameters before anything is
+// allocated, so --memory-budget can size the beam (or reject it) up front.
+//
+// Every large allocation is counted: the lookup tables (plus a replica per NUMA
+// node in use), every State (each holds a 2^n pattern array), the two beams, and the
+// per-level candidate and selection arrays. With --spill-dir the beams and
+// candidate arrays live in files and count against free disk space instead.
+
+struct MemoryEstimate {
+    std::size_t lookup_table_bytes = 0;   // One copy
+    std::size_t num_lookup_copies = 0;
+    std::size_t state_bytes = 0;          // One State
+    std::size_t num_states = 0;
+    std::size_t beam_bytes = 0;           // Both beams
+    std::size_t candidate_bytes = 0;      // Candidate and selection records
+    std::size_t hash_set_bytes = 0;       // In-memory deduplication only
+    std::size_t successor_bytes = 0;      // Selected successors and worker candidate buffers
+    bool spilled = false;
+
+    [[nodiscard]] std::size_t lookup_tables() const { return lookup_table_bytes * num_lookup_copies; }
+    [[nodiscard]] std::size_t states() const { return state_bytes * num_states; }
+
+    [[nodiscard]] std::size_t resident() const {
+        return lookup_tables() + states() + hash_set_bytes + successor_bytes +
+               (spilled ? 0 : beam_bytes + candidate_bytes);
+    }
+    [[nodiscard]] std::size_t on_disk() const { return spilled ? beam_bytes + candidate_bytes : 0; }
+};
+
+// Number of lookup table copies, as BeamSearchContext makes them: the caller's
+// tables, plus one replica per NUMA node that pinned workers run on once any of
+// them runs off node 0. The caller's copy stays alive next to the replicas.
+inline std::size_t count_lookup_copies(int num_threads, bool pin_threads) {
+    const std::vector<int> nodes = worker_numa_nodes(num_threads, pin_threads);
+    if (*std::max_element(nodes.begin(), nodes.end()) == 0) return 1;
+    return 1 + std::set<int>(nodes.begin(), nodes.end()).size();
+}
+
+inline MemoryEstimate estimate_memory(int net_size, int beam_size, int num_threads, int length_upper_bound,
+                                      std::size_t num_lookup_copies, bool spilled) {
+    const std::size_t num_patterns = std::size_t{1} << net_size;
+    const std::size_t num_comparators = static_cast<std::size_t>(net_size) * (net_size - 1) / 2;
+    const std::size_t threads = static_cast<std::size_t>(num_threads);
+    const std::size_t beam = static_cast<std::size_t>(beam_size);
+    const std::size_t ops = static_cast<std::size_t>(length_upper_bound);
+
+    MemoryEstimate estimate;
+    estimate.spilled = spilled;
+
+    // is_sorted, CSR offsets, and the allowed comparators: each comparator is
+    // allowed for the 2^(n-2) patterns with a 0 on its first wire and a 1 on its second
+    estimate.lookup_table_bytes = num_patterns * sizeof(std::uint8_t) +
+                                  (num_patterns + 1) * sizeof(std::uint64_t) +
+                                  num_comparators * (num_patterns / 4) * sizeof(Operation);
+    estimate.num_lookup_copies = num_lookup_copies;
+
+    // Result and start states, each worker's parent and rollout states, and the
+    // candidate states used when rollouts are split across workers
+    const std::size_t element_bytes = net_size <= 8  ? sizeof(PatternListElement<std::uint8_t>) :
+                                      net_size <= 16 ? sizeof(PatternListElement<std::uint16_t>) :
+                                                       sizeof(PatternListElement<std::uint32_t>);
+    estimate.state_bytes = num_patterns * element_bytes + ops * sizeof(Operation);
+    estimate.num_states = 2 + 3 * threads;
+
+    estimate.beam_bytes = 2 * beam * ops * sizeof(Operation);
+
+    // Candidates and their selection records; external sorts need a second copy of each
+    const std::size_t max_candidates = beam * num_comparators;
+    estimate.candidate_bytes = max_candidates * (sizeof(CandidateSuccessor) + sizeof(ScoredCandidate)) * (spilled ? 2 : 1);
+
+    if (!spilled) {
+        std::size_t slots = 16;
+        while (slots < max_candidates * 2) slots *= 2;
+        estimate.hash_set_bytes = slots * sizeof(std::uint64_t);
+    }
+
+    estimate.successor_bytes = beam * sizeof(StateSuccessor) + threads * CANDIDATE_FLUSH_SIZE * sizeof(CandidateSuccessor);
+    return estimate;
+}
+
+inline MemoryEstimate estimate_memory(const Config& config, int beam_size, std::size_t num_lookup_copies) {
+    return estimate_memory(config.get_net_size(), beam_size, config.get_num_threads(),
+                           config.get_length_upper_bound(), num_lookup_copies, !config.get_spill_dir().empty());
+}
+
+// Free space available to this user in a directory, or 0 if unknown.
+inline std::size_t free_disk_bytes(const std::string& dir) {
+    struct statvfs fs;
+    if (statvfs(dir.c_str(), &fs) != 0) return 0;
+    return static_cast<std::size_t>(fs.f_bavail) * fs.f_frsize;
+}
+
+// Parse a byte count such as "512M", "64G" or "1T" (binary units; no suffix = bytes).
+// Returns 0 if the text is not a valid size.
+inline std::size_t parse_byte_size(const std::string& text) {
+    std::size_t pos = 0;
+    double value = 0.0;
+    try {
+        value = std::stod(text, &pos);
+    } catch (const std::exception&) {
+        return 0;
+    }
+    if (value <= 0.0) return 0;
+
+    std::string suffix = text.substr(pos);
+    if (!suffix.empty() && (suffix.back() == 'B' || suffix.back() == 'b')) suffix.pop_back();
+    int shift = 0;
+    if (suffix == "K" || suffix == "k") shift = 10;
+    else if (suffix == "M" || suffix == "m") shift = 20;
+    else if (suffix == "G" || suffix == "g") shift = 30;
+    else if (suffix == "T" || suffix == "t") shift = 40;
+    else if (!suffix.empty()) return 0;
+
+    return static_cast<std::size_t>(value * static_cast<double>(std::uint64_t{1} << shift));
+}
+
+// Human-readable byte count, e.g. "1.5 GiB".
+inline std::string format_bytes(std::size_t bytes) {
+    static const char* const units[] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB"};
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 5) {
+        value /= 1024.0;
+        unit++;
+    }
+
+    char text[32];
+    std::snprintf(text, sizeof(text), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return text;
+}
+
+inline void print_memory_estimate(const MemoryEstimate& estimate, std::size_t budget) {
+    std::cout << "Memory estimate         : " << format_bytes(estimate.resident());
+    if (budget > 0) std::cout << " of " << format_bytes(budget) << " budget";
+    std::cout << "\n"
+              << "  Lookup tables         : " << estimate.num_lookup_copies << " x "
+              << format_bytes(estimate.lookup_table_bytes) << "\n"
+              << "  States                : " << estimate.num_states << " x "
+              << format_bytes(estimate.state_bytes) << "\n"
+              << "  Beams                 : " << format_bytes(estimate.beam_bytes)
+              << (estimate.spilled ? " (on disk)" : "") << "\n"
+              << "  Candidates            : " << format_bytes(estimate.candidate_bytes)
+              << (estimate.spilled ? " (on disk)" : "") << "\n";
+    if (!estimate.spilled) {
+        std::cout << "  Dedup hash set        : " << format_bytes(estimate.hash_set_bytes) << "\n";
+    }
+    std::cout << "  Selected successors   : " << format_bytes(estimate.successor_bytes) << "\n" << std::endl;
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "alloc_tracking.h"
+#include "perf_counters.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+// Per-level telemetry for --metrics FILE.
+//
+// Every level of the beam search appends one JSON object on its own line (JSON
+// Lines) with the wall time of each phase, candidate counts, the work done by the
+// rollouts, the scores of the selected beam and, with --perf-counters, the
+// hardware counters of each phase (see perf_counters.h), and in allocation
+// tracking builds the heap allocations of each phase (see alloc_tracking.h).
+// Lines are flushed as they are written, so a running search can be followed
+// with tail -f and a killed one still leaves every completed level behind.
+
+// Work counted by the thread that does it. Each is a plain add to a thread-local
+// variable, cheap enough to stay enabled in release builds; the search sums the
+// workers' counters at the end of each level.
+struct WorkCounters {
+    std::uint64_t rollouts = 0;         // Rollouts run to completion
+    std::uint64_t pattern_touches = 0;  // Unsorted patterns visited by update_state()
+
+    WorkCounters& operator+=(const WorkCounters& other) {
+        rollouts += other.rollouts;
+        pattern_touches += other.pattern_touches;
+        return *this;
+    }
+};
+
+inline thread_local WorkCounters work_counters;
+
+// Phases of a level, timed separately.
+enum SearchPhase {
+    PHASE_COLLECT,   // Expansion and deduplication
+    PHASE_SCORE,     // Rollouts, all halving rounds
+    PHASE_SORT,      // Ranking, all halving rounds
+    PHASE_REBUILD,
+    NUM_PHASES
+};
+
+inline constexpr std::array<const char*, NUM_PHASES> PHASE_NAMES = {"collect", "score", "sort", "rebuild"};
+
+// Everything recorded about one level.
+struct LevelMetrics {
+    int level = 0;
+    int beam_size = 0;             // Parents expanded this level
+    std::size_t generated = 0;     // Candidates before deduplication
+    std::size_t unique = 0;        // Candidates after deduplication
+    std::size_t selected = 0;      // Candidates kept for the next beam
+    int halving_rounds = 0;
+    bool complete = false;         // A sorting network was found at this level
+    WorkCounters work;
+
+    // Wall time of each phase in seconds, and its hardware counters (if any)
+    std::array<double, NUM_PHASES> seconds{};
+    std::array<PerfCounts, NUM_PHASES> perf{};
+
+    // Heap allocations of each phase, and of the whole level (only counted when
+    // ALLOCATION_TRACKING)
+    std::array<AllocCounts, NUM_PHASES> allocations{};
+    AllocCounts level_allocations;
+
+    // Scores of the selected candidates (only when they were scored)
+    bool scored = false;
+    double score_min = 0.0;
+    double score_mean = 0.0;
+    double score_p50 = 0.0;
+    double score_max = 0.0;
+    double score_stddev = 0.0;
+
+    std::size_t peak_rss_bytes = 0;
+};
+
+// Peak resident set size of the process so far, or 0 if unknown.
+inline std::size_t peak_rss_bytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return static_cast<std::size_t>(usage.ru_maxrss) * 1024;  // ru_maxrss is in KiB on Linux
+}
+
+inline double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Fill the score fields of metrics from scores sorted in ascending order.
+inline void summarize_scores(LevelMetrics& metrics, const std::vector<double>& sorted_scores) {
+    metrics.scored = !sorted_scores.empty();
+    if (!metrics.scored) return;
+
+    const std::size_t n = sorted_scores.size();
+    double sum = 0.0;
+    for (double score : sorted_scores) sum += score;
+    const double mean = sum / static_cast<double>(n);
+    double squares = 0.0;
+    for (double score : sorted_scores) squares += (score - mean) * (score - mean);
+
+    metrics.score_min = sorted_scores.front();
+    metrics.score_max = sorted_scores.back();
+    metrics.score_mean = mean;
+    metrics.score_p50 = n % 2 == 1 ? sorted_scores[n / 2] : 0.5 * (sorted_scores[n / 2 - 1] + sorted_scores[n / 2]);
+    metrics.score_stddev = std::sqrt(squares / static_cast<double>(n));
+}
+
+// Print the hardware counters of each phase, summed over the whole run.
+inline void print_perf_summary(const std::array<PerfCounts, NUM_PHASES>& totals) {
+    if (totals[PHASE_COLLECT].available == 0) return;
+
+    std::ostringstream text;
+    text.precision(3);
+    text << "Hardware counters:\n";
+    for (int phase = 0; phase < NUM_PHASES; ++phase) {
+        const PerfCounts& counts = totals[phase];
+        text << "  " << PHASE_NAMES[phase] << std::string(9 - std::strlen(PHASE_NAMES[phase]), ' ') << ':';
+        for (int event = 0; event < NUM_PERF_EVENTS; ++event) {
+            if (counts.has(event)) text << ' ' << PERF_EVENT_NAMES[event] << ' ' << static_cast<double>(counts.values[event]);
+        }
+        if (counts.has(PERF_CYCLES) && counts.has(PERF_INSTRUCTIONS) && counts.values[PERF_CYCLES] > 0) {
+            text << " (IPC " << static_cast<double>(counts.values[PERF_INSTRUCTIONS]) / counts.values[PERF_CYCLES] << ')';
+        }
+        text << '\n';
+    }
+    std::cout << text.str();
+}
+
+// Receives the metrics of each level as the level completes.
+class LevelObserver {
+public:
+    virtual ~LevelObserver() = default;
+    virtual void on_level(const LevelMetrics& metrics) = 0;
+};
+
+class MetricsWriter : public LevelObserver {
+public:
+    explicit MetricsWriter(const std::string& path) : out_(path, std::ios::out | std::ios::trunc) {
+        if (!out_) {
+            throw std::runtime_error("Cannot open metrics file " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    // Iteration number written with the following levels.
+    void set_iteration(int iteration) { iteration_ = iteration; }
+
+    void on_level(const LevelMetrics& m) override {
+        std::ostringstream line;
+        line.precision(9);
+        line << "{\"iteration\":" << iteration_
+             << ",\"level\":" << m.level
+             << ",\"beam_size\":" << m.beam_size
+             << ",\"generated\":" << m.generated
+             << ",\"unique\":" << m.unique
+             << ",\"selected\":" << m.selected
+             << ",\"halving_rounds\":" << m.halving_rounds
+             << ",\"complete\":" << (m.complete ? "true" : "false")
+             << ",\"rollouts\":" << m.work.rollouts
+             << ",\"pattern_touches\":" << m.work.pattern_touches
+             << ",\"seconds\":{";
+        double total = 0.0;
+        for (int phase = 0; phase < NUM_PHASES; ++phase) {
+            line << '"' << PHASE_NAMES[phase] << "\":" << m.seconds[phase] << ',';
+            total += m.seconds[phase];
+        }
+        line << "\"total\":" << total << '}';
+        if (m.scored) {
+            line << ",\"score\":{\"min\":" << m.score_min
+                 << ",\"mean\":" << m.score_mean
+                 << ",\"p50\":" << m.score_p50
+                 << ",\"max\":" << m.score_max
+                 << ",\"stddev\":" << m.score_stddev << '}';
+        } else {
+            line << ",\"score\":null";
+        }
+        if (m.perf[PHASE_COLLECT].available != 0) {
+            line << ",\"perf\":{";
+            for (int phase = 0; phase < NUM_PHASES; ++phase) {
+                line << (phase > 0 ? "," : "") << '"' << PHASE_NAMES[phase] << "\":{";
+                bool first = true;
+                for (int event = 0; event < NUM_PERF_EVENTS; ++event) {
+                    if (!m.perf[phase].has(event)) continue;
+                    line << (first ? "" : ",") << '"' << PERF_EVENT_NAMES[event] << "\":" << m.perf[phase].values[event];
+                    first = false;
+                }
+                line << '}';
+            }
+            line << '}';
+        }
+        if (ALLOCATION_TRACKING) {
+            line << ",\"allocations\":{";
+            for (int phase = 0; phase < NUM_PHASES; ++phase) {
+                line << '"' << PHASE_NAMES[phase] << "\":{\"count\":" << m.allocations[phase].count
+                     << ",\"bytes\":" << m.allocations[phase].bytes << "},";
+            }
+            line << "\"total\":{\"count\":" << m.level_allocations.count
+                 << ",\"bytes\":" << m.level_allocations.bytes << "}}";
+        }
+        line << ",\"peak_rss_bytes\":" << m.peak_rss_bytes << "}\n";
+
+        out_ << line.str();
+        out_.flush();
+    }
+
+private:
+    std::ofstream out_;
+    int iteration_ = 0;
+};
@@ -33,8 +33,8 @@ inline std::uint64_t fnv1a_hash(const std::vector<Operation>& ops, int num_ops)
 
 // Compute degree of each bus based on operation sequence
 template<int NetSize>
-void compute_bus_degrees(const std::vector<Operation>& ops, int num_ops, 
-                         std::array<int, MAX_NET_SIZE>& degrees) {
+void compute_bus_degrees(const std::vector<Operation>& ops, int num_ops,
+                         std::array<int, NetSize>& degrees) {
     degrees.fill(0);
     for (int i = 0; i < num_ops; ++i) {
         degrees[ops[i].op1]++;
@@ -45,8 +45,8 @@ void compute_bus_degrees(const std::vector<Operation>& ops, int num_ops,
 // Compute sum of neighbor degrees for tie-breaking
 template<int NetSize>
 void compute_neighbor_sums(const std::vector<Operation>& ops, int num_ops,
-                           const std::array<int, MAX_NET_SIZE>& degrees,
-                           std::array<int, MAX_NET_SIZE>& neighbor_sums) {
+                           const std::array<int, NetSize>& degrees,
+                           std::array<int, NetSize>& neighbor_sums) {
     neighbor_sums.fill(0);
     for (int i = 0; i < num_ops; ++i) {
         neighbor_sums[ops[i].op1] += degrees[ops[i].op2];
@@ -57,21 +57,20 @@ void compute_neighbor_sums(const std::vector<Operation>& ops, int num_ops,
 // Greedy canonical labeling algorithm from Choi & Moon paper
 // Assigns labels based on structural properties (degree, connectivity)
 template<int NetSize>
-std::array<std::uint8_t, MAX_NET_SIZE> compute_canonical_mapping(const std::vector<Operation>& ops, 
-                                                       int num_ops, int net_size) {
-    std::array<std::uint8_t, MAX_NET_SIZE> mapping;
-    std::array<bool, MAX_NET_SIZE> assigned;
+std::array<std::uint8_t, NetSize> compute_canonical_mapping(const std::vector<Operation>& ops, int num_ops) {
+    std::array<std::uint8_t, NetSize> mapping;
+    std::array<bool, NetSize> assigned;
     mapping.fill(INVALID_LABEL);  // Invalid marker
     assigned.fill(false);
     
     // Compute structural signatures
-    std::array<int, MAX_NET_SIZE> degrees;
-    std::array<int, MAX_NET_SIZE> neighbor_sums;
+    std::array<int, NetSize> degrees;
+    std::array<int, NetSize> neighbor_sums;
     compute_bus_degrees<NetSize>(ops, num_ops, degrees);
     compute_neighbor_sums<NetSize>(ops, num_ops, degrees, neighbor_sums);
     
     // Greedily assign canonical labels
-    for (int new_label = 0; new_label < net_size; ++new_label) {
+    for (int new_label = 0; new_label < NetSize; ++new_label) {
         // Find unassigned bus with highest priority:
         // 1. Highest degree
         // 2. Tie-break: highest neighbor degree sum
@@ -80,7 +79,7 @@ std::array<std::uint8_t, MAX_NET_SIZE> compute_canonical_mapping(const std::vect
         int best_degree = -1;
         int best_neighbor_sum = -1;
         
-        for (int bus = 0; bus < net_size; ++bus) {
+        for (int bus = 0; bus < NetSize; ++bus) {
             if (assigned[bus]) continue;
             
             if (degrees[bus] > best_degree ||
@@ -114,7 +113,7 @@ std::array<std::uint8_t, MAX_NET_SIZE> compute_canonical_mapping(const std::vect
 // Apply canonical mapping to a sequence of operations
 template<int NetSize>
 void apply_canonical_mapping(std::vector<Operation>& ops, int num_ops, 
-                             const std::array<std::uint8_t, MAX_NET_SIZE>& mapping) {
+                             const std::array<std::uint8_t, NetSize>& mapping) {
     for (int i = 0; i < num_ops; ++i) {
         std::uint8_t new_op1 = mapping[ops[i].op1];
         std::uint8_t new_op2 = mapping[ops[i].op2];
@@ -129,79 +128,79 @@ void apply_canonical_mapping(std::vector<Operation>& ops, int num_ops,
 
 // Sort operations within each parallel layer for consistent representation
 template<int NetSize>
-void normalize_operation_order(std::vector<Operation>& ops, int num_ops, int net_size) {
-    // Group operations into parallel layers
-    std::vector<std::vector<Operation>> layers;
-    std::vector<bool> used(net_size, false);
-    
+void normalize_operation_order(std::vector<Operation>& ops, int num_ops) {
+    // Layers are written to a separate buffer, since every layer is collected
+    // from the original sequence. A layer uses disjoint wires, so it holds at
+    // most NetSize / 2 operations.
+    thread_local std::vector<Operation> ordered;
+    ordered.resize(static_cast<std::size_t>(num_ops));
+    std::array<Operation, NetSize / 2> layer;
+    int idx = 0;
+
     for (int i = 0; i < num_ops; ) {
-        std::vector<Operation> layer;
-        std::fill(used.begin(), used.end(), false);
-        
+        WireMask<NetSize> used = 0;
+        int layer_size = 0;
+
         // Collect all operations that can run in parallel starting from position i
-        for (int j = i; j < num_ops; ++j) {
-            if (!used[ops[j].op1] && !used[ops[j].op2]) {
-                layer.push_back(ops[j]);
-                used[ops[j].op1] = true;
-                used[ops[j].op2] = true;
+        for (int j = i; j < num_ops && layer_size < NetSize / 2; ++j) {
+            const auto wires = static_cast<WireMask<NetSize>>((1u << ops[j].op1) | (1u << ops[j].op2));
+            if (!(used & wires)) {
+                layer[layer_size++] = ops[j];
+                used |= wires;
             }
         }
-        
-        if (layer.empty()) {
+
+        if (layer_size == 0) {
             // Should not happen if operations are valid, but handle gracefully
-            layer.push_back(ops[i]);
+            layer[layer_size++] = ops[i];
             i++;
         } else {
-            i += static_cast<int>(layer.size());
+            i += layer_size;
         }
-        
+
         // Sort operations within layer by first operand
-        std::sort(layer.begin(), layer.end(), 
+        std::sort(layer.begin(), layer.begin() + layer_size,
                   [](const Operation& a, const Operation& b) {
                       return a.op1 < b.op1 || (a.op1 == b.op1 && a.op2 < b.op2);
                   });
-        
-        layers.push_back(std::move(layer));
-    }
-    
-    // Flatten back to operation sequence
-    int idx = 0;
-    for (const auto& layer : layers) {
-        for (const auto& op : layer) {
-            ops[idx++] = op;
+
+        for (int k = 0; k < layer_size; ++k) {
+            ordered[idx++] = layer[k];
         }
     }
+
+    std::copy(ordered.begin(), ordered.begin() + idx, ops.begin());
 }
 
 // Full canonical normalization: compute mapping, apply it, and normalize order
 template<int NetSize>
-void canonical_normalize(std::vector<Operation>& ops, int num_ops, int net_size) {
+void canonical_normalize(std::vector<Operation>& ops, int num_ops) {
     if (num_ops <= 0) return;
     
     // Step 1: Compute and apply canonical mapping
-    auto mapping = compute_canonical_mapping<NetSize>(ops, num_ops, net_size);
+    auto mapping = compute_canonical_mapping<NetSize>(ops, num_ops);
     apply_canonical_mapping<NetSize>(ops, num_ops, mapping);
     
     // Step 2: Normalize order within parallel layers
-    normalize_operation_order<NetSize>(ops, num_ops, net_size);
+    normalize_operation_order<NetSize>(ops, num_ops);
 }
 
 // Compute canonical hash of operation sequence
 // This ensures isomorphic networks produce identical hashes
 template<int NetSize>
-std::uint64_t compute_canonical_hash(const std::vector<Operation>& ops, int num_ops, int net_size) {
+HOT_KERNEL std::uint64_t compute_canonical_hash(const std::vector<Operation>& ops, int num_ops) {
     if (num_ops <= 0) return 0;
     
-    // Make a copy since canonical_normalize modifies in place
+    // Make a copy since canonical_normalize modifies in place. The buffer grows
+    // geometrically, so it is reallocated only a few times per thread.
     thread_local std::vector<Operation> normalized_ops;
     normalized_ops.clear();
-    normalized_ops.reserve(num_ops);
     for (int i = 0; i < num_ops; ++i) {
         normalized_ops.push_back(ops[i]);
     }
     
     // Apply canonical normalization
-    canonical_normalize<NetSize>(normalized_ops, num_ops, net_size);
+    canonical_normalize<NetSize>(normalized_ops, num_ops);
     
     // Compute hash on normalized sequence
     return fnv1a_hash(normalized_ops, num_ops);
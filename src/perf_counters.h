@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hardware performance counters for --perf-counters.
+//
+// Each worker opens its own set of counters with perf_event_open, counting only
+// its own thread in user space. The search reads every worker's counters at phase
+// boundaries (reading a thread's counters does not require running on it) and
+// attributes the difference to the phase, next to its wall time in --metrics.
+//
+// Counters are often restricted (kernel.perf_event_paranoid) or missing
+// altogether in containers and VMs. Each event is opened on its own, so events
+// the host does not support are left out while the others are still counted,
+// and if none can be opened the search runs as usual without them.
+
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,
+    NUM_PERF_EVENTS
+};
+
+inline constexpr std::array<const char*, NUM_PERF_EVENTS> PERF_EVENT_NAMES = {
+    "cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses"
+};
+
+// Counts of each event; only the events in the available bit mask are meaningful.
+struct PerfCounts {
+    std::array<std::uint64_t, NUM_PERF_EVENTS> values{};
+    unsigned available = 0;
+
+    [[nodiscard]] bool has(int event) const { return (available >> event) & 1; }
+
+    PerfCounts& operator+=(const PerfCounts& other) {
+        for (int e = 0; e < NUM_PERF_EVENTS; ++e) values[e] += other.values[e];
+        available |= other.available;
+        return *this;
+    }
+
+    PerfCounts& operator-=(const PerfCounts& other) {
+        for (int e = 0; e < NUM_PERF_EVENTS; ++e) values[e] -= other.values[e];
+        return *this;
+    }
+};
+
+// Counters of one thread.
+class PerfCounterSet {
+public:
+    PerfCounterSet() { fds_.fill(-1); }
+    ~PerfCounterSet() { close_all(); }
+
+    PerfCounterSet(const PerfCounterSet&) = delete;
+    PerfCounterSet& operator=(const PerfCounterSet&) = delete;
+
+    // Open every supported event for the calling thread. Returns a bit mask of the
+    // events opened; if it is 0, error() says why the first event failed.
+    unsigned open() {
+        close_all();
+        for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            set_event(attr, static_cast<PerfEvent>(e));
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            const long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+            if (fd >= 0) {
+                fds_[e] = static_cast<int>(fd);
+                available_ |= 1u << e;
+            } else if (error_.empty()) {
+                error_ = std::strerror(errno);
+            }
+        }
+        return available_;
+    }
+
+    [[nodiscard]] unsigned available() const { return available_; }
+    [[nodiscard]] const std::string& error() const { return error_; }
+
+    // Add the counts so far to counts. When the kernel had to multiplex a counter,
+    // its count is scaled up to the full time it was enabled.
+    void read_into(PerfCounts& counts) const {
+        for (int e = 0; e < NUM_PERF_EVENTS; ++e) {
+            if (fds_[e] < 0) continue;
+            std::uint64_t data[3];  // value, time enabled, time running
+            if (::read(fds_[e], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) continue;
+            std::uint64_t value = data[0];
+            if (data[2] > 0 && data[2] < data[1]) {
+                value = static_cast<std::uint64_t>(static_cast<double>(value) * data[1] / data[2]);
+            }
+            counts.values[e] += value;
+        }
+        counts.available |= available_;
+    }
+
+private:
+    std::array<int, NUM_PERF_EVENTS> fds_;
+    unsigned available_ = 0;
+    std::string error_;
+
+    static void set_event(perf_event_attr& attr, PerfEvent event) {
+        auto cache_miss = [](std::uint64_t cache) {
+            return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        };
+        switch (event) {
+            case PERF_CYCLES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case PERF_INSTRUCTIONS:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case PERF_LLC_MISSES:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = cache_miss(PERF_COUNT_HW_CACHE_LL);
+                break;
+            case PERF_BRANCH_MISSES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+            case PERF_DTLB_MISSES:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void close_all() {
+        for (int& fd : fds_) {
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+        }
+        available_ = 0;
+    }
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "config.h"
+#include "lookup.h"
+#include "state.h"
+#include "types.h"
+#include "normalization.h"
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <string>
+#include <unordered_set>
+#include <cstdint>
+
+// Two-layer prefix enumeration.
+// The first layer of a sorting network can be assumed to be a maximal matching,
+// and only a small number of second layers are non-isomorphic. Rather than let
+// the beam search rediscover this, we fix layer 1 and enumerate the canonical
+// second layers, giving a set of prefixes to start the search from.
+
+// First layer: the reflection-symmetric maximal matching (i, n-1-i).
+// For odd n the middle wire is left unmatched.
+inline std::vector<Operation> first_layer(int net_size) {
+    std::vector<Operation> layer;
+    for (int i = 0; i < net_size / 2; ++i) {
+        layer.push_back(Operation{static_cast<std::uint8_t>(i), static_cast<std::uint8_t>(net_size - 1 - i)});
+    }
+    return layer;
+}
+
+// Canonical form of a two-layer prefix whose first layer_1_size operations are
+// layer 1. Every wire is in at most one comparator per layer, so the comparators
+// form disjoint paths and cycles that alternate between the layers. Each one is
+// written down as the sequence of comparators along it, with the layer of each and
+// whether the walk enters it at its min end, and the smallest of its rotations and
+// reversals is kept. Two prefixes with the same form differ only by relabelling
+// wires (and possibly reflecting the network), so their outputs are equal up to a
+// permutation and they lead to networks of the same size and depth.
+inline std::string two_layer_canonical_form(const std::vector<Operation>& prefix, int net_size,
+                                            std::size_t layer_1_size) {
+    // A comparator is written as '0' + 2 * layer + (0 if entered at its min end,
+    // else 1), so flipping the low bit swaps its ends
+    constexpr char CYCLE = 'c';
+    constexpr char PATH = 'p';
+
+    // The comparator on each wire per layer, and its code when walked from this wire
+    struct Link {
+        int other = -1;
+        char code = 0;
+    };
+    std::vector<std::array<Link, 2>> links(static_cast<std::size_t>(net_size));
+    for (std::size_t k = 0; k < prefix.size(); ++k) {
+        const int layer = k < layer_1_size ? 0 : 1;
+        const char code = static_cast<char>('0' + 2 * layer);
+        links[prefix[k].op1][layer] = {prefix[k].op2, code};
+        links[prefix[k].op2][layer] = {prefix[k].op1, static_cast<char>(code + 1)};
+    }
+
+    // Walk from start along its layer link, alternating layers, until the walk
+    // ends or returns to start
+    std::vector<bool> visited(static_cast<std::size_t>(net_size), false);
+    auto walk = [&](int start, int layer) {
+        std::string codes;
+        int wire = start;
+        visited[wire] = true;
+        while (links[wire][layer].other >= 0) {
+            codes.push_back(links[wire][layer].code);
+            wire = links[wire][layer].other;
+            layer ^= 1;
+            if (wire == start) break;
+            visited[wire] = true;
+        }
+        return codes;
+    };
+
+    std::vector<std::string> paths;
+    std::vector<std::string> cycles;
+    for (int wire = 0; wire < net_size; ++wire) {
+        if (visited[wire]) continue;
+        if (links[wire][0].other < 0) paths.push_back(walk(wire, 1));
+        else if (links[wire][1].other < 0) paths.push_back(walk(wire, 0));
+    }
+    for (int wire = 0; wire < net_size; ++wire) {
+        if (!visited[wire]) cycles.push_back(walk(wire, 0));
+    }
+
+    // Reflecting the network swaps the min and max end of every comparator, and
+    // walking the other way reverses the sequence and swaps the ends as well
+    std::string best;
+    for (int reflect = 0; reflect < 2; ++reflect) {
+        std::vector<std::string> components;
+        auto add = [&](const std::string& codes, char kind) {
+            std::string forward(codes);
+            std::string backward(codes.rbegin(), codes.rend());
+            for (char& code : forward) code = static_cast<char>(code ^ reflect);
+            for (char& code : backward) code = static_cast<char>(code ^ reflect ^ 1);
+
+            std::string smallest;
+            for (const std::string* seq : {&forward, &backward}) {
+                const std::size_t rotations = kind == CYCLE ? seq->size() : 1;
+                for (std::size_t r = 0; r < rotations; ++r) {
+                    std::string candidate(1, kind);
+                    candidate.append(*seq, r).append(*seq, 0, r);
+                    if (smallest.empty() || candidate < smallest) smallest = std::move(candidate);
+                }
+            }
+            components.push_back(std::move(smallest));
+        };
+        for (const auto& codes : paths) add(codes, PATH);
+        for (const auto& codes : cycles) add(codes, CYCLE);
+        std::sort(components.begin(), components.end());
+
+        std::string form;
+        for (const auto& component : components) {
+            form += component;
+            form += ' ';
+        }
+        if (reflect == 0 || form < best) best = std::move(form);
+    }
+    return best;
+}
+
+// Enumerate first_layer() followed by every maximal second layer, up to isomorphism.
+//
+// Second layers are built one comparator at a time from the comparators that are
+// non-redundant after layer 1. After each step the partial layers are deduplicated
+// by canonical hash, so isomorphic partial layers are only extended once. A layer is
+// complete when no further non-redundant comparator fits on its free wires, and
+// complete prefixes are deduplicated exactly by two_layer_canonical_form(). The
+// hash alone splits many equivalent layers: for n=16 it leaves 3756 prefixes, of
+// which 513 are distinct.
+//
+// Prefixes are returned with the ones leaving the fewest unsorted patterns first.
+template<int NetSize>
+std::vector<std::vector<Operation>> enumerate_two_layer_prefixes(const Config& config, const LookupTables& lookups) {
+    const int net_size = config.get_net_size();
+    const std::vector<Operation> layer1 = first_layer(net_size);
+
+    State<NetSize> layer1_state(config);
+    layer1_state.set_start_state(config, lookups);
+    for (const auto& op : layer1) {
+        layer1_state.update_state(op.op1, op.op2, lookups);
+    }
+
+    typename State<NetSize>::SuccessorRows succ_rows{};
+    static_cast<void>(layer1_state.find_successors(succ_rows));
+
+    std::vector<Operation> layer2_ops;
+    for (const Operation& op : Comparators<NetSize>::OPS) {
+        if ((succ_rows[op.op1] >> op.op2) & 1) {
+            layer2_ops.push_back(op);
+        }
+    }
+
+    std::vector<std::vector<Operation>> prefixes;
+    std::unordered_set<std::string> complete_forms;
+    std::vector<std::vector<Operation>> frontier{layer1};
+
+    while (!frontier.empty()) {
+        std::vector<std::vector<Operation>> next_frontier;
+        std::unordered_set<std::uint64_t> partial_hashes;
+
+        for (auto& prefix : frontier) {
+            std::uint32_t used_wires = 0;
+            for (std::size_t i = layer1.size(); i < prefix.size(); ++i) {
+                used_wires |= (1u << prefix[i].op1) | (1u << prefix[i].op2);
+            }
+
+            bool extended = false;
+            for (const auto& op : layer2_ops) {
+                if (used_wires & ((1u << op.op1) | (1u << op.op2))) continue;
+                extended = true;
+
+                prefix.push_back(op);
+                auto hash = compute_canonical_hash<NetSize>(prefix, static_cast<int>(prefix.size()));
+                if (partial_hashes.insert(hash).second) {
+                    next_frontier.push_back(prefix);
+                }
+                prefix.pop_back();
+            }
+
+            if (!extended) {
+                if (complete_forms.insert(two_layer_canonical_form(prefix, net_size, layer1.size())).second) {
+                    prefixes.push_back(std::move(prefix));
+                }
+            }
+        }
+
+        frontier = std::move(next_frontier);
+    }
+
+    // Order by how far each prefix has already collapsed the unsorted set
+    std::vector<std::pair<int, std::size_t>> order;
+    order.reserve(prefixes.size());
+    State<NetSize> prefix_state(config);
+    for (std::size_t i = 0; i < prefixes.size(); ++i) {
+        prefix_state = layer1_state;
+        for (std::size_t j = layer1.size(); j < prefixes[i].size(); ++j) {
+            prefix_state.update_state(prefixes[i][j].op1, prefixes[i][j].op2, lookups);
+        }
+        order.emplace_back(prefix_state.num_unsorted, i);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<std::vector<Operation>> sorted_prefixes;
+    sorted_prefixes.reserve(prefixes.size());
+    for (const auto& [num_unsorted, i] : order) {
+        sorted_prefixes.push_back(std::move(prefixes[i]));
+    }
+    return sorted_prefixes;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// USDT (SystemTap SDT) static probes, for attaching bpftrace, perf or SystemTap
+// to a running search without restarting it.
+//
+// When <sys/sdt.h> is available (e.g. from systemtap-sdt-dev), each probe compiles
+// to a single nop plus an ELF note describing where its arguments live, so a probe
+// with nothing attached costs next to nothing. Without the header, or when built
+// with -DNO_USDT, the probes compile to nothing. All probes use the provider
+// sorting_networks:
+//
+//   level_start(level, beam_size)
+//   dedup(level, generated, unique)
+//   halving_start(level, round, candidates, tests_per_candidate)
+//   halving_end(level, round, survivors)
+//   level_end(level, selected)
+//   rollout_done(length, depth)
+//   network_found(length, depth)
+//
+// e.g. bpftrace -e 'usdt:./sorting_networks:sorting_networks:level_end { printf("%d\n", arg0); }'
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define USDT_PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef USDT_PROBES_ENABLED
+#define SN_PROBE2(name, a, b) DTRACE_PROBE2(sorting_networks, name, a, b)
+#define SN_PROBE3(name, a, b, c) DTRACE_PROBE3(sorting_networks, name, a, b, c)
+#define SN_PROBE4(name, a, b, c, d) DTRACE_PROBE4(sorting_networks, name, a, b, c, d)
+#else
+#define USDT_PROBES_ENABLED 0
+#define SN_PROBE2(name, a, b) ((void)0)
+#define SN_PROBE3(name, a, b, c) ((void)0)
+#define SN_PROBE4(name, a, b, c, d) ((void)0)
+#endif
@@ -0,0 +1,502 @@
+#include "config.h"
+#include "lookup.h"
+#include "state.h"
+#include "search.h"
+#include "snapshot.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "topology.h"
+#include "bench_stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Replays a search level saved with --snapshot-levels and times its phases on
+// exactly that workload: the same beam, the same candidates and the same
+// parameters as the production run.
+//
+// Each phase is timed in --repeats repeats of at least --min-time seconds:
+//   collect  expansion of the beam and deduplication of its candidates
+//   select   successive halving of the snapshot's candidates, reported as a
+//            whole and split into its score and sort phases
+//   rebuild  building the next beam from the selected candidates
+// Every run starts from the snapshot's candidates, so selection sees the same
+// input each time.
+//
+// With --scaling, the level is replayed at 1, 2, 4, ... --max-threads threads
+// and each phase's speedup, parallel efficiency and serial fraction are
+// reported. Strong scaling replays the whole level at every thread count; weak
+// scaling gives each thread count a share of the beam in proportion to its
+// threads. With --perf-counters, one further run of each replay counts the
+// last-level cache read misses of every phase, as an estimate of the memory
+// bandwidth it uses.
+
+struct ReplayOptions {
+    std::string snapshot_file;
+    int repeats = 10;
+    double min_seconds = 0.1;
+    int num_threads = 0;
+    bool perf_counters = false;
+    std::string scaling;   // Empty, "strong" or "weak"
+    int max_threads = 0;   // Largest thread count of a scaling study, 0 = one per available CPU
+    std::string json_file;
+    std::string baseline_file;
+    double threshold = 0.10;
+};
+
+// Results of one replay, in the order collect, score, sort, select, rebuild,
+// and the time and counters of each phase in a further instrumented run.
+struct ReplayRun {
+    int threads = 0;
+    std::vector<BenchResult> results;
+    LevelMetrics counters;
+    bool counted = false;
+};
+
+enum ReplayResult { RESULT_COLLECT, RESULT_SCORE, RESULT_SORT, RESULT_SELECT, RESULT_REBUILD };
+
+// Bytes per second read from memory by a phase, estimated from its last-level
+// cache read misses at one cache line each, or -1 if they were not counted.
+inline double miss_bandwidth(const LevelMetrics& counters, SearchPhase phase) {
+    const PerfCounts& perf = counters.perf[phase];
+    if (!perf.has(PERF_LLC_MISSES) || counters.seconds[phase] <= 0.0) return -1.0;
+    return static_cast<double>(perf.values[PERF_LLC_MISSES]) * 64.0 / counters.seconds[phase];
+}
+
+inline std::string format_bandwidth(double bytes_per_second) {
+    if (bytes_per_second < 0.0) return "-";
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.2f GB/s", bytes_per_second / 1e9);
+    return text;
+}
+
+inline Config make_replay_config(const ReplayOptions& options, const LevelSnapshot& snapshot, int num_threads) {
+    // All 17 significant digits, so the weight parses back to exactly the snapshot's
+    char depth_weight[32];
+    std::snprintf(depth_weight, sizeof(depth_weight), "%.17g", snapshot.depth_weight);
+    std::vector<std::string> args = {"replay_benchmark", "-n", std::to_string(snapshot.net_size),
+                                     "-b", std::to_string(snapshot.max_beam_size),
+                                     "-t", std::to_string(snapshot.num_scoring_tests),
+                                     "-w", depth_weight,
+                                     snapshot.use_symmetry ? "-s" : "-S",
+                                     "-T", std::to_string(num_threads)};
+    if (options.perf_counters) args.push_back("-C");
+    std::vector<char*> argv;
+    for (auto& arg : args) argv.push_back(arg.data());
+    Config config;
+    config.parse_args(static_cast<int>(argv.size()), argv.data());
+    if (snapshot.level >= config.get_length_upper_bound()) {
+        throw std::runtime_error("Snapshot level " + std::to_string(snapshot.level) + " is beyond the length upper bound");
+    }
+    return config;
+}
+
+// Replay snapshot with num_threads workers, appending suffix to the phase names.
+template<int NetSize>
+ReplayRun replay_level(const ReplayOptions& options, const LevelSnapshot& snapshot, const LookupTables& lookups,
+                       const State<NetSize>& start_state, int num_threads, const std::string& suffix) {
+    const Config config = make_replay_config(options, snapshot, num_threads);
+    BeamSearchContext<NetSize> context(config, lookups);
+    context.load_level(snapshot);
+
+    ReplayRun run;
+    run.threads = config.get_num_threads();
+    auto add = [&](const char* phase, std::vector<double> samples) {
+        run.results.push_back(summarize_samples(phase + suffix, NetSize, std::move(samples)));
+        print_result(run.results.back());
+    };
+    const bool use_symmetry = config.get_use_symmetry_heuristic();
+    const int max_beam_size = config.get_max_beam_size();
+
+    add("collect", measure_samples(options.repeats, options.min_seconds, [&] {
+        context.beam_successors.clear();
+        context.candidates.clear();
+    }, [&] {
+        keep(context.collect_candidates_parallel(snapshot.level, use_symmetry, start_state, config));
+        return 1;
+    }));
+    if (context.candidates.size() != snapshot.candidates.size()) {
+        std::cerr << "Warning: collection found " << context.candidates.size() << " unique candidates, the snapshot "
+                  << snapshot.candidates.size() << "\n";
+    }
+
+    // Selection, timed as a whole and by phase from the context's own phase timers
+    std::vector<double> select_samples;
+    std::vector<double> score_samples;
+    std::vector<double> sort_samples;
+    auto select = [&] {
+        context.load_level(snapshot);
+        SilenceOutput quiet;  // Selection prints the tests of each round
+        const auto start = std::chrono::steady_clock::now();
+        context.select_best_candidates(snapshot.level, max_beam_size, start_state, config);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    static_cast<void>(select());  // Warm-up
+    for (int repeat = 0; repeat < options.repeats; ++repeat) {
+        double seconds = 0.0;
+        double score_seconds = 0.0;
+        double sort_seconds = 0.0;
+        int runs = 0;
+        do {
+            seconds += select();
+            score_seconds += context.current_level_metrics().seconds[PHASE_SCORE];
+            sort_seconds += context.current_level_metrics().seconds[PHASE_SORT];
+            runs++;
+        } while (seconds < options.min_seconds);
+        select_samples.push_back(seconds * 1e9 / runs);
+        score_samples.push_back(score_seconds * 1e9 / runs);
+        sort_samples.push_back(sort_seconds * 1e9 / runs);
+    }
+    add("score", std::move(score_samples));
+    add("sort", std::move(sort_samples));
+    add("select", std::move(select_samples));
+
+    // rebuild_beam() swaps the new level in; swap it back out before the next run
+    bool rebuilt = false;
+    add("rebuild", measure_samples(options.repeats, options.min_seconds, [&] {
+        if (rebuilt) context.beam.swap(context.temp_beam);
+        context.current_beam_size = snapshot.beam_size;
+    }, [&] {
+        context.rebuild_beam(snapshot.level);
+        rebuilt = true;
+        return 1;
+    }));
+
+    // One more run of the whole level, measured by the context's phase timers
+    // and hardware counters
+    if (config.get_perf_counters()) {
+        if (rebuilt) context.beam.swap(context.temp_beam);
+        context.load_level(snapshot);
+        context.candidates.clear();
+        context.begin_phase();
+        keep(context.collect_candidates_parallel(snapshot.level, use_symmetry, start_state, config));
+        context.end_phase(PHASE_COLLECT);
+        {
+            SilenceOutput quiet;
+            context.select_best_candidates(snapshot.level, max_beam_size, start_state, config);
+        }
+        context.begin_phase();
+        context.rebuild_beam(snapshot.level);
+        context.end_phase(PHASE_REBUILD);
+        run.counters = context.current_level_metrics();
+        run.counted = true;
+    }
+    return run;
+}
+
+// Thread counts of a scaling study: powers of two up to max_threads, and
+// max_threads itself.
+inline std::vector<int> scaling_thread_counts(int max_threads) {
+    std::vector<int> counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) counts.push_back(threads);
+    counts.push_back(max_threads);
+    return counts;
+}
+
+// Speedup, parallel efficiency and serial fraction of each phase at each thread
+// count, relative to one thread.
+//
+// Strong scaling: speedup S = T1 / Tp and efficiency S / p. The serial fraction
+// is the Karp-Flatt metric (1/S - 1/p) / (1 - 1/p), the fraction of the work
+// that Amdahl's law would have to treat as serial to explain S.
+// Weak scaling: efficiency T1 / Tp, scaled speedup p * T1 / Tp, and Gustafson's
+// serial fraction (p - S) / (p - 1).
+void print_scaling_report(const ReplayOptions& options, const std::vector<ReplayRun>& runs) {
+    struct Phase {
+        const char* name;
+        std::vector<ReplayResult> results;
+        std::vector<SearchPhase> counted;
+    };
+    const std::vector<Phase> phases = {
+        {"collect", {RESULT_COLLECT}, {PHASE_COLLECT}},
+        {"score", {RESULT_SCORE}, {PHASE_SCORE}},
+        {"sort", {RESULT_SORT}, {PHASE_SORT}},
+        {"rebuild", {RESULT_REBUILD}, {PHASE_REBUILD}},
+        {"level", {RESULT_COLLECT, RESULT_SELECT, RESULT_REBUILD}, {PHASE_COLLECT, PHASE_SCORE, PHASE_SORT, PHASE_REBUILD}},
+    };
+    const bool weak = options.scaling == "weak";
+    auto mean_ns = [](const ReplayRun& run, const Phase& phase) {
+        double total = 0.0;
+        for (ReplayResult result : phase.results) total += run.results[result].mean;
+        return total;
+    };
+    auto bandwidth = [](const ReplayRun& run, const Phase& phase) {
+        if (!run.counted) return -1.0;
+        double misses = 0.0;
+        double seconds = 0.0;
+        for (SearchPhase counted : phase.counted) {
+            if (!run.counters.perf[counted].has(PERF_LLC_MISSES)) return -1.0;
+            misses += static_cast<double>(run.counters.perf[counted].values[PERF_LLC_MISSES]);
+            seconds += run.counters.seconds[counted];
+        }
+        return seconds > 0.0 ? misses * 64.0 / seconds : -1.0;
+    };
+
+    std::cout << "\n" << (weak ? "Weak" : "Strong") << " scaling relative to 1 thread:\n"
+              << "  phase    threads         time   speedup  efficiency   serial     memory read\n";
+    for (const Phase& phase : phases) {
+        const double base = mean_ns(runs.front(), phase);
+        for (const ReplayRun& run : runs) {
+            const double p = run.threads;
+            const double time = mean_ns(run, phase);
+            const double efficiency = weak ? base / time : base / time / p;
+            const double speedup = efficiency * p;
+            char serial[16] = "-";
+            if (run.threads > 1) {
+                const double fraction = weak ? (p - speedup) / (p - 1.0) : (1.0 / speedup - 1.0 / p) / (1.0 - 1.0 / p);
+                std::snprintf(serial, sizeof(serial), "%.3f", fraction);
+            }
+            char line[160];
+            std::snprintf(line, sizeof(line), "  %-8s %7d %12s %8.2fx %10.1f%% %8s %15s\n", phase.name, run.threads,
+                          format_nanoseconds(time).c_str(), speedup, 100.0 * efficiency, serial,
+                          format_bandwidth(bandwidth(run, phase)).c_str());
+            std::cout << line;
+        }
+    }
+
+    // The phase that loses the most time to imperfect scaling limits the level
+    const ReplayRun& widest = runs.back();
+    if (widest.threads > 1) {
+        const Phase* limit = nullptr;
+        double most_lost = 0.0;
+        for (std::size_t i = 0; i + 1 < phases.size(); ++i) {
+            const double ideal = weak ? mean_ns(runs.front(), phases[i])
+                                      : mean_ns(runs.front(), phases[i]) / widest.threads;
+            const double lost = mean_ns(widest, phases[i]) - ideal;
+            if (limit == nullptr || lost > most_lost) {
+                limit = &phases[i];
+                most_lost = lost;
+            }
+        }
+        std::cout << "At " << widest.threads << " threads " << limit->name << " loses the most time to scaling: "
+                  << format_nanoseconds(std::max(most_lost, 0.0)) << " of "
+                  << format_nanoseconds(mean_ns(widest, phases.back())) << " per level\n";
+    }
+}
+
+template<int NetSize>
+std::vector<BenchResult> replay(const ReplayOptions& options, const LevelSnapshot& snapshot) {
+    const Config config = make_replay_config(options, snapshot, 1);
+    LookupTables lookups;
+    lookups.initialize(config);
+
+    // Every beam entry starts with the prefix the search started from
+    State<NetSize> start_state(config);
+    start_state.set_start_state(config, lookups);
+    start_state.apply_operations(snapshot.beam_entry(0), snapshot.prefix_length, lookups);
+
+    State<NetSize> parent(config);
+    parent = start_state;
+    parent.apply_operations(snapshot.beam_entry(0) + snapshot.prefix_length, snapshot.level - snapshot.prefix_length,
+                            lookups);
+
+    const int max_threads = options.max_threads > 0 ? options.max_threads : default_thread_count();
+    std::cout << "NET_SIZE                = " << NetSize << "\n"
+              << "LEVEL                   = " << snapshot.level << "\n"
+              << "BEAM_SIZE               = " << snapshot.beam_size << " of " << snapshot.max_beam_size << "\n"
+              << "CANDIDATES              = " << snapshot.num_generated << " generated, "
+              << snapshot.candidates.size() << " unique\n"
+              << "UNSORTED_PATTERNS       = " << parent.num_unsorted << " (first beam entry)\n"
+              << "NUM_SCORING_TESTS       = " << snapshot.num_scoring_tests << "\n";
+    if (options.scaling.empty()) {
+        std::cout << "NUM_THREADS             = "
+                  << (options.num_threads > 0 ? options.num_threads : default_thread_count()) << "\n";
+    } else {
+        std::cout << "SCALING                 = " << options.scaling << ", 1 to " << max_threads << " threads\n";
+    }
+    std::cout << "PERF_COUNTERS           = " << (options.perf_counters ? "Yes" : "No") << "\n"
+              << "CPU_DISPATCH            = " << cpu_dispatch_level() << "\n\n";
+
+    if (options.scaling.empty()) {
+        const ReplayRun run = replay_level(options, snapshot, lookups, start_state, options.num_threads, "");
+        if (run.counted) {
+            std::cout << "\nMemory read bandwidth (last-level cache read misses x 64 B):\n";
+            for (int phase = 0; phase < NUM_PHASES; ++phase) {
+                char line[96];
+                std::snprintf(line, sizeof(line), "  %-24s %15s\n", PHASE_NAMES[phase],
+                              format_bandwidth(miss_bandwidth(run.counters, static_cast<SearchPhase>(phase))).c_str());
+                std::cout << line;
+            }
+        }
+        return run.results;
+    }
+
+    std::vector<ReplayRun> runs;
+    std::vector<BenchResult> results;
+    for (int threads : scaling_thread_counts(max_threads)) {
+        // Weak scaling: a share of the beam in proportion to the threads
+        const int entries = options.scaling == "weak"
+            ? std::max(1, static_cast<int>(static_cast<std::int64_t>(snapshot.beam_size) * threads / max_threads))
+            : snapshot.beam_size;
+        LevelSnapshot slice;
+        if (entries < snapshot.beam_size) slice = slice_snapshot(snapshot, entries);
+        const LevelSnapshot& level = entries < snapshot.beam_size ? slice : snapshot;
+
+        std::cout << "Threads: " << threads;
+        if (entries < snapshot.beam_size) std::cout << " (" << entries << " beam entries)";
+        std::cout << "\n";
+        runs.push_back(replay_level(options, level, lookups, start_state, threads, "_T" + std::to_string(threads)));
+        results.insert(results.end(), runs.back().results.begin(), runs.back().results.end());
+    }
+    print_scaling_report(options, runs);
+    return results;
+}
+
+std::vector<BenchResult> replay(const ReplayOptions& options, const LevelSnapshot& snapshot) {
+    switch (snapshot.net_size) {
+        case 2: return replay<2>(options, snapshot);
+        case 3: return replay<3>(options, snapshot);
+        case 4: return replay<4>(options, snapshot);
+        case 5: return replay<5>(options, snapshot);
+        case 6: return replay<6>(options, snapshot);
+        case 7: return replay<7>(options, snapshot);
+        case 8: return replay<8>(options, snapshot);
+        case 9: return replay<9>(options, snapshot);
+        case 10: return replay<10>(options, snapshot);
+        case 11: return replay<11>(options, snapshot);
+        case 12: return replay<12>(options, snapshot);
+        case 13: return replay<13>(options, snapshot);
+        case 14: return replay<14>(options, snapshot);
+        case 15: return replay<15>(options, snapshot);
+        case 16: return replay<16>(options, snapshot);
+        case 17: return replay<17>(options, snapshot);
+        case 18: return replay<18>(options, snapshot);
+        case 19: return replay<19>(options, snapshot);
+        case 20: return replay<20>(options, snapshot);
+        case 21: return replay<21>(options, snapshot);
+        case 22: return replay<22>(options, snapshot);
+        case 23: return replay<23>(options, snapshot);
+        case 24: return replay<24>(options, snapshot);
+        case 25: return replay<25>(options, snapshot);
+        case 26: return replay<26>(options, snapshot);
+        case 27: return replay<27>(options, snapshot);
+        case 28: return replay<28>(options, snapshot);
+        case 29: return replay<29>(options, snapshot);
+        case 30: return replay<30>(options, snapshot);
+        case 31: return replay<31>(options, snapshot);
+        case 32: return replay<32>(options, snapshot);
+        default: throw std::runtime_error("Unsupported net_size in snapshot");
+    }
+}
+
+void print_replay_usage(const char* program_name) {
+    const ReplayOptions defaults;
+    std::cout << "Usage: " << program_name << " [options] SNAPSHOT\n\n"
+              << "Times the phases of a search level saved with --snapshot-levels.\n\n"
+              << "Options:\n"
+              << "  -r, --repeats N              Timed repeats per phase (default: " << defaults.repeats << ")\n"
+              << "      --min-time SECONDS       Minimum measured time per repeat (default: " << defaults.min_seconds << ")\n"
+              << "  -T, --threads N              Worker threads, 0 = one per available CPU (default: "
+              << defaults.num_threads << ")\n"
+              << "  -C, --perf-counters          Estimate each phase's memory read bandwidth from cache misses\n"
+              << "      --scaling MODE           Replay at 1, 2, 4, ... threads: strong (same level) or weak\n"
+              << "                               (beam share in proportion to the threads)\n"
+              << "      --max-threads N          Largest thread count of --scaling, 0 = one per available CPU\n"
+              << "                               (default: " << defaults.max_threads << ")\n"
+              << "  -j, --json FILE              Write the results to FILE as JSON\n"
+              << "  -c, --compare FILE           Compare with the results in FILE, written earlier by --json\n"
+              << "  -x, --threshold PERCENT      Slowdown that counts as a regression (default: "
+              << defaults.threshold * 100.0 << ")\n"
+              << "  -h, --help                   Show this help message\n";
+}
+
+ReplayOptions parse_replay_args(int argc, char* argv[]) {
+    ReplayOptions options;
+    auto number = [&](int& i, const char* name) {
+        try {
+            return std::stod(argv[++i]);
+        } catch (const std::exception&) {
+            throw std::invalid_argument(std::string("Invalid value for ") + name);
+        }
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            print_replay_usage(argv[0]);
+            std::exit(0);
+        }
+        else if ((arg == "-r" || arg == "--repeats") && i + 1 < argc) {
+            options.repeats = static_cast<int>(number(i, "--repeats"));
+        }
+        else if (arg == "--min-time" && i + 1 < argc) {
+            options.min_seconds = number(i, "--min-time");
+        }
+        else if ((arg == "-T" || arg == "--threads") && i + 1 < argc) {
+            options.num_threads = static_cast<int>(number(i, "--threads"));
+        }
+        else if (arg == "-C" || arg == "--perf-counters") {
+            options.perf_counters = true;
+        }
+        else if (arg == "--scaling" && i + 1 < argc) {
+            options.scaling = argv[++i];
+            if (options.scaling != "strong" && options.scaling != "weak") {
+                throw std::invalid_argument("Invalid value for --scaling (expected strong or weak)");
+            }
+        }
+        else if (arg == "--max-threads" && i + 1 < argc) {
+            options.max_threads = static_cast<int>(number(i, "--max-threads"));
+        }
+        else if ((arg == "-j" || arg == "--json") && i + 1 < argc) {
+            options.json_file = argv[++i];
+        }
+        else if ((arg == "-c" || arg == "--compare") && i + 1 < argc) {
+            options.baseline_file = argv[++i];
+        }
+        else if ((arg == "-x" || arg == "--threshold") && i + 1 < argc) {
+            options.threshold = number(i, "--threshold") / 100.0;
+        }
+        else if (!arg.empty() && arg[0] != '-' && options.snapshot_file.empty()) {
+            options.snapshot_file = arg;
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            print_replay_usage(argv[0]);
+            std::exit(1);
+        }
+    }
+
+    if (options.snapshot_file.empty()) {
+        throw std::invalid_argument("No snapshot file given");
+    }
+    if (options.repeats < 2) {
+        throw std::invalid_argument("repeats must be at least 2 for a confidence interval");
+    }
+    if (options.min_seconds < 0.0 || options.threshold < 0.0 || options.num_threads < 0 || options.max_threads < 0) {
+        throw std::invalid_argument("min-time, threshold, threads and max-threads must not be negative");
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    int regressions = 0;
+    try {
+        const ReplayOptions options = parse_replay_args(argc, argv);
+        Baseline baseline;
+        if (!options.baseline_file.empty()) baseline = load_baseline(options.baseline_file);
+        const LevelSnapshot snapshot = read_snapshot(options.snapshot_file);
+
+        const std::vector<BenchResult> results = replay(options, snapshot);
+        if (!options.json_file.empty()) {
+            const int threads = options.scaling.empty() ? options.num_threads : options.max_threads;
+            write_results_json(options.json_file, results, cpu_dispatch_level(),
+                               threads > 0 ? threads : default_thread_count(), options.repeats);
+            std::cout << "Results written to " << options.json_file << "\n";
+        }
+        if (!baseline.empty()) regressions = compare_to_baseline(results, baseline, options.threshold);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    if (regressions > 0) {
+        std::cout << "FAILED: " << regressions << " phase(s) slower than the baseline.\n";
+        return 1;
+    }
+    return 0;
+}
@@ -4,6 +4,16 @@
 #include "state.h"
 #include "types.h"
 #include "normalization.h"
+#include "concurrent_set.h"
+#include "worker_pool.h"
+#include "topology.h"
+#include "spill.h"
+#include "external_sort.h"
+#include "metrics.h"
+#include "trace.h"
+#include "probes.h"
+#include "snapshot.h"
+#include "checkpoint.h"
 #include <vector>
 #include <algorithm>
 #include <memory>
@@ -12,7 +22,9 @@
 #include <chrono>
 #include <cmath>
 #include <unordered_set>
-#include <unordered_map>
+#include <atomic>
+#include <bit>
+#include <tuple>
 
 // Profiling macros for timing beam search phases.
 // Define ENABLE_PROFILING before including this header to enable timing output.
@@ -29,110 +41,627 @@
     #define PROFILE_END(name, desc)
 #endif
 
-// Represents a candidate successor operation to be scored.
-// Used to batch all scoring work into a single parallel region.
-struct CandidateSuccessor {
-    std::size_t beam_index;   // Which beam entry this belongs to
-    std::uint8_t op1;         // First wire of comparator
-    std::uint8_t op2;         // Second wire of comparator
-    std::uint64_t canonical_hash; // Canonical hash for isomorphic deduplication
-};
+// With --spill-dir, arrays are sorted in runs of this many bytes (see external_sort.h).
+inline constexpr std::size_t SPILL_RUN_BYTES = std::size_t{64} << 20;
+
+// Returned by beam_search() when its cancel flag was set before a network was found.
+inline constexpr int SEARCH_CANCELLED = -1;
 
 template<int NetSize>
 [[gnu::always_inline]] inline
 std::uint64_t build_operation_sequence(std::vector<Operation>& ops,
-                                        const std::vector<Operation>& beam_ops,
+                                        const Operation* beam_ops,
                                         int level,
                                         std::uint8_t new_op1,
-                                        std::uint8_t new_op2,
-                                        int net_size) {
+                                        std::uint8_t new_op2) {
     ops.clear();
     ops.reserve(level + 1);
     for (int j = 0; j < level; ++j) {
         ops.push_back(beam_ops[j]);
     }
     ops.push_back(Operation{new_op1, new_op2});
-    return compute_canonical_hash<NetSize>(ops, level + 1, net_size);
+    return compute_canonical_hash<NetSize>(ops, level + 1);
 }
 
 // BeamSearchContext maintains the state for beam search across iterations.
 // The beam holds the top-k most promising partial networks found so far.
+//
+// The context owns a persistent WorkerPool. Each worker has its own arena of
+// scratch buffers, allocated once by the worker itself and reused for every task
+// it runs: expanding a parent, scoring a candidate, or running a single rollout.
+//
+// With --pin, workers are pinned to CPUs before allocating their arenas, so the
+// arenas live on the worker's NUMA node. On multi-node hosts the read-only lookup
+// tables are also replicated, one copy per node, and each worker reads its own
+// node's copy.
+//
+// With --spill-dir, the beams, candidates and selection arrays are backed by files
+// in that directory (see spill.h). Deduplication then sorts the candidates by hash
+// instead of using an in-memory hash set, and each halving round sorts the scored
+// candidates, both as external-memory run sorts and merges (see external_sort.h).
+//
+// Every phase of a level is timed, and with --perf-counters each worker also
+// opens hardware counters for its thread, which are read around each phase.
+// With --trace, phases and worker tasks are also recorded on a timeline (see trace.h).
+// With --snapshot-levels, the chosen levels are saved for replay (see snapshot.h).
+// With --checkpoint, the beam is saved at the end of a level every
+// --checkpoint-interval seconds, so --resume can continue it (see checkpoint.h).
+//
+// A search can be cancelled through set_cancel_flag(). Every parallel task and
+// every rollout checks the flag, so a level stops within one rollout of it being
+// set, rather than at the end of the search.
+template<int NetSize>
 class BeamSearchContext {
 public:
-    // Each beam entry stores a sequence of operations (comparators).
-    // beam[i][j] is the j-th operation of the i-th beam entry.
-    std::vector<std::vector<Operation>> beam;
+    // Each beam entry stores a sequence of operations (comparators) in a row of
+    // beam_stride operations: beam_entry(i)[j] is the j-th operation of entry i.
+    SpillArray<Operation> beam;
+
+    // Storage for building the next beam level, swapped with beam afterwards.
+    SpillArray<Operation> temp_beam;
 
-    // Temporary storage for building the next beam level.
-    std::vector<std::vector<Operation>> temp_beam;
+    std::size_t beam_stride = 0;
 
-    // All candidate successors from current beam entries, scored and sorted.
+    // Candidates selected for the next beam, best first.
     std::vector<StateSuccessor> beam_successors;
 
     // Buffer for collecting all candidate successors before parallel scoring.
-    std::vector<CandidateSuccessor> candidates;
+    SpillArray<CandidateSuccessor> candidates;
+
+    // Canonical hashes of the candidates collected so far this level.
+    // Duplicates are dropped as they are generated, so no separate dedup pass is
+    // needed. Not used with --spill-dir, which deduplicates by sorting.
+    ConcurrentHashSet candidate_hashes;
+
+    // Number of candidates generated this level, before deduplication.
+    std::size_t num_generated = 0;
+
+    // Hardware counters of each phase, summed over all levels searched so far.
+    // Empty (no available events) unless --perf-counters is given and supported.
+    std::array<PerfCounts, NUM_PHASES> perf_totals{};
 
     int current_beam_size = 1;
 
-    explicit BeamSearchContext(const Config& config) {
-        resize(config);
+    // lookups must outlive the context; workers read it (or a per-node copy).
+    BeamSearchContext(const Config& config, const LookupTables& lookups);
+
+    // Lookup tables in memory: the caller's, and a copy per node if replicated.
+    // count_lookup_copies() predicts this for the memory estimate.
+    [[nodiscard]] std::size_t num_lookup_tables() const {
+        return 1 + static_cast<std::size_t>(std::count_if(lookup_replicas.begin(), lookup_replicas.end(),
+                                                          [](const auto& replica) { return replica != nullptr; }));
     }
 
     void resize(const Config& config);
 
-    inline void copy_candidates_to_successors(
-        std::vector<StateSuccessor>& successors,
-        const std::vector<CandidateSuccessor>& candidates,
-        const std::vector<double>& scores,
-        size_t count);
-
-    // Perform beam search starting from an empty network.
-    // Returns the length of the best network found.
-    template<int NetSize>
-    [[nodiscard]] int beam_search(State<NetSize>& result, const Config& config, const LookupTables& lookups);
-
-    // Phase 1: Collect candidate successors in parallel.
+    // Record phases and worker tasks in tracer from now on. tracer must outlive
+    // the context.
+    void set_tracer(Tracer* tracer);
+
+    // Stop searching soon after *flag becomes true; beam_search() then returns
+    // SEARCH_CANCELLED. flag must outlive the context.
+    void set_cancel_flag(const std::atomic<bool>* flag) { cancel_flag = flag; }
+
+    // Write a snapshot of each of these levels into dir the first time the
+    // search reaches it, after its candidates are collected.
+    void set_snapshot_levels(const std::vector<int>& levels, const std::string& dir);
+
+    // Write a checkpoint to path at the end of a level once interval_seconds have
+    // passed since the last one. progress holds the parts only the caller knows:
+    // the iteration and its prefix, the best network so far and the time
+    // searched before this run. It must outlive the context.
+    void set_checkpoint(const std::string& path, double interval_seconds, const SearchCheckpoint* progress);
+
+    // Write a checkpoint now. With level > 0 it holds the beam of that level,
+    // which the search is about to expand; with level 0 it marks the end of an
+    // iteration.
+    void save_checkpoint(const Config& config, int level = 0);
+
+    // Continue from a checkpoint: restore the workers' random number generators
+    // and, if it holds a beam, make the next beam_search() start from that level.
+    void resume_from(const SearchCheckpoint& checkpoint);
+
+    // Snapshot of the current level, whose candidates have been collected.
+    [[nodiscard]] LevelSnapshot capture_level(int level, const State<NetSize>& start_state,
+                                              const Config& config) const;
+
+    // Restore the beam and candidates of a snapshot's level, so its phases can
+    // be run again. The context must have been created with the snapshot's
+    // parameters.
+    void load_level(const LevelSnapshot& snapshot);
+
+    // Measurements of the level being searched (or last searched) so far.
+    [[nodiscard]] const LevelMetrics& current_level_metrics() const { return level_metrics; }
+
+    // Measure a phase: the time and counters between the two calls are added to
+    // the phase's totals in level_metrics (and perf_totals). Public so a replayed
+    // level can measure the phases it runs one at a time.
+    void begin_phase();
+    void end_phase(SearchPhase phase);
+
+    [[nodiscard]] const Operation* beam_entry(std::size_t i) const { return beam.data() + i * beam_stride; }
+
+    // Fill beam_successors with the first count candidates in active,
+    // with their scores if they were scored.
+    inline void copy_candidates_to_successors(size_t count, bool scored);
+
+    // Perform beam search starting from start_state, which is either the empty
+    // network or a prefix network whose operations have already been applied.
+    // If metrics is given, it receives the measurements of every level.
+    // Returns the length of the best network found, or SEARCH_CANCELLED if the
+    // cancel flag was set first. A cancelled level is saved with --checkpoint.
+    [[nodiscard]] int beam_search(State<NetSize>& result, const State<NetSize>& start_state,
+                                  const Config& config, const LookupTables& lookups,
+                                  LevelObserver* metrics = nullptr);
+
+    // Phase 1: Collect candidate successors in parallel, deduplicating them with
+    // canonical hashing as they are generated (or afterwards, with --spill-dir).
     // Returns index of a completed network if found, -1 otherwise.
-    template<int NetSize>
-    [[gnu::flatten]] int collect_candidates_parallel(int level, int net_size, bool use_symmetry,
-                                                        const Config& config, const LookupTables& lookups);
+    [[gnu::flatten]] int collect_candidates_parallel(int level, bool use_symmetry,
+                                                     const State<NetSize>& start_state,
+                                                     const Config& config);
 
-    // Phase 2: Deduplicate candidates using canonical hashing.
-    // Returns pair of (before_count, after_count).
-    std::pair<std::size_t, std::size_t> deduplicate_candidates();
-
-    // Phase 3: Select best candidates using successive halving algorithm.
-    template<int NetSize>
+    // Phase 2: Select best candidates using successive halving algorithm.
     [[gnu::flatten]] void select_best_candidates(int level, int max_beam_size,
-                                                  const Config& config, const LookupTables& lookups);
+                                                 const State<NetSize>& start_state,
+                                                 const Config& config);
 
-    // Phase 4: Rebuild beam from selected successors.
+    // Phase 3: Rebuild beam from selected successors.
     void rebuild_beam(int level);
+
+private:
+    // Scratch buffers owned by one worker.
+    struct WorkerArena {
+        explicit WorkerArena(const Config& config)
+            : state(config),
+              rollout_state(config) {
+            ops.reserve(config.get_length_upper_bound());
+            candidates.reserve(CANDIDATE_FLUSH_SIZE);
+        }
+
+        State<NetSize> state;                      // Reconstructed parent or candidate
+        State<NetSize> rollout_state;              // Working copy for a single rollout
+        typename State<NetSize>::SuccessorRows succ_rows{}; // Valid successors, one bitmask row per op1
+        std::vector<Operation> ops;                // Operation sequence for hashing
+        std::vector<CandidateSuccessor> candidates; // Candidates found by this worker, not yet flushed
+        std::size_t generated = 0;                 // Candidates generated, before dedup
+        WorkCounters work;                         // This worker's counters, as last collected
+        PerfCounterSet perf;                       // Hardware counters of this worker's thread
+    };
+
+    std::unique_ptr<WorkerPool> pool;
+    std::vector<std::unique_ptr<WorkerArena>> arenas;
+
+    // Per-node copies of the lookup tables (only when replicated), and the
+    // tables each worker should read.
+    std::vector<std::unique_ptr<LookupTables>> lookup_replicas;
+    std::vector<const LookupTables*> worker_lookups;
+
+    // Number of candidates copied into candidates so far this level.
+    std::atomic<std::size_t> candidate_count{0};
+
+    // Selection buffers, refilled every level. They are reserved for a full
+    // level in resize() and never shrink, so steady-state levels do not allocate.
+    SpillArray<ScoredCandidate> active;   // Candidates still in the running, best first after each round
+
+    // Merge targets for the external sorts, used only with --spill-dir.
+    SpillArray<CandidateSuccessor> candidates_sorted;
+    SpillArray<ScoredCandidate> active_sorted;
+
+    // Candidate states and their summed rollout scores, used only when rounds
+    // are split into individual rollouts. Candidates are split a batch at a time,
+    // so both hold one entry per worker; the states are allocated the first time
+    // a round is split.
+    std::size_t split_threshold = 0;
+    std::vector<State<NetSize>> candidate_states;
+    std::unique_ptr<std::atomic<double>[]> rollout_totals;
+
+    // Measurements of the current level, written out with --metrics.
+    LevelMetrics level_metrics;
+    std::vector<double> selected_scores;
+
+    // Start of the phase being measured, and whether hardware counters are read.
+    std::chrono::steady_clock::time_point phase_start_time;
+    PerfCounts phase_start_perf;
+    bool perf_enabled = false;
+    std::uint64_t phase_start_ns = 0;
+    AllocCounts phase_start_allocations;
+    AllocCounts level_start_allocations;
+
+    Tracer* tracer = nullptr;  // Null unless --trace is given
+    const std::atomic<bool>* cancel_flag = nullptr;
+
+    // Levels still to be saved with --snapshot-levels, and where
+    std::vector<int> snapshot_levels;
+    std::string snapshot_dir;
+
+    // --checkpoint: where and how often, and the level beam_search() resumes at
+    // (-1 = start from start_state)
+    std::string checkpoint_path;
+    double checkpoint_interval = 0.0;
+    const SearchCheckpoint* checkpoint_progress = nullptr;
+    std::chrono::steady_clock::time_point checkpoint_clock;
+    std::chrono::steady_clock::time_point last_checkpoint;
+    int resume_level = -1;
+
+    [[nodiscard]] bool cancelled() const {
+        return cancel_flag != nullptr && cancel_flag->load(std::memory_order_relaxed);
+    }
+
+    // Abandon level, whose beam is still intact: save it with --checkpoint so a
+    // resumed search repeats it, and return SEARCH_CANCELLED.
+    int cancel_level(int level, const Config& config);
+
+    // Rebuild the state of beam entry beam_index at the given level.
+    void reconstruct_state(State<NetSize>& state, const State<NetSize>& start_state,
+                           std::size_t beam_index, int level, const LookupTables& lookups) const;
+
+    // Copy a worker's pending candidates into the shared candidate array.
+    void flush_candidates(WorkerArena& arena);
+
+    // Sort the scored active candidates, best first, keeping at least the first keep.
+    void sort_active(std::size_t count, std::size_t keep);
+
+    // Sum and reset every worker's work counters.
+    WorkCounters collect_work_counters();
+
+    // Finish level_metrics for this level and pass it on.
+    void write_level_metrics(LevelObserver& metrics);
+
+    // Sum of every worker's hardware counters so far.
+    PerfCounts read_perf_counters() const;
+
+    // Write the snapshot of this level if it was asked for and not yet written.
+    void write_requested_snapshot(int level, const State<NetSize>& start_state, const Config& config);
 };
 
-inline void BeamSearchContext::resize(const Config& config) {
+template<int NetSize>
+BeamSearchContext<NetSize>::BeamSearchContext(const Config& config, const LookupTables& lookups)
+    : beam(config.get_spill_dir()),
+      temp_beam(config.get_spill_dir()),
+      candidates(config.get_spill_dir()),
+      pool(std::make_unique<WorkerPool>(config.get_num_threads())),
+      arenas(static_cast<std::size_t>(pool->size())),
+      worker_lookups(static_cast<std::size_t>(pool->size()), &lookups),
+      active(config.get_spill_dir()),
+      candidates_sorted(config.get_spill_dir()),
+      active_sorted(config.get_spill_dir()) {
+    const std::vector<int> cpus = allowed_cpus();
+    const bool pin = config.get_pin_threads() && !cpus.empty();
+
+    // NUMA node of the CPU each worker will be pinned to
+    const std::vector<int> worker_nodes = worker_numa_nodes(pool->size(), pin);
+
+    // Each worker pins itself, then allocates (and so first-touches) its own arena
+    std::atomic<int> pin_failures{0};
+    pool->run_on_each_worker([&](int worker) {
+        if (pin && !pin_current_thread(cpus[worker % cpus.size()])) {
+            pin_failures.fetch_add(1, std::memory_order_relaxed);
+        }
+        arenas[worker] = std::make_unique<WorkerArena>(config);
+        if (config.get_perf_counters()) arenas[worker]->perf.open();
+        if (config.get_seed() != 0) State<NetSize>::seed_thread_rng(config.get_seed(), worker);
+    });
+    if (pin_failures.load() > 0) {
+        std::cerr << "Warning: failed to pin " << pin_failures.load() << " worker thread(s)" << std::endl;
+    }
+
+    // Workers on the same host support the same events, so worker 0 speaks for all
+    if (config.get_perf_counters()) {
+        const unsigned available = arenas[0]->perf.available();
+        perf_enabled = (available != 0);
+        if (!perf_enabled) {
+            std::cerr << "Warning: hardware counters unavailable (perf_event_open: " << arenas[0]->perf.error()
+                      << "), continuing without them" << std::endl;
+        } else if (available != (1u << NUM_PERF_EVENTS) - 1) {
+            std::cerr << "Warning: hardware counters not supported here:";
+            for (int event = 0; event < NUM_PERF_EVENTS; ++event) {
+                if (!((available >> event) & 1)) std::cerr << ' ' << PERF_EVENT_NAMES[event];
+            }
+            std::cerr << std::endl;
+        }
+    }
+
+    // Replicate the lookup tables on every node in use: the first worker on each
+    // node makes the copy, so its pages are first-touched on that node
+    const int num_nodes = *std::max_element(worker_nodes.begin(), worker_nodes.end()) + 1;
+    if (num_nodes > 1) {
+        std::vector<int> node_owner(static_cast<std::size_t>(num_nodes), -1);
+        for (std::size_t w = 0; w < worker_nodes.size(); ++w) {
+            if (node_owner[worker_nodes[w]] == -1) node_owner[worker_nodes[w]] = static_cast<int>(w);
+        }
+
+        lookup_replicas.resize(static_cast<std::size_t>(num_nodes));
+        pool->run_on_each_worker([&](int worker) {
+            const int node = worker_nodes[worker];
+            if (node_owner[node] == worker) {
+                lookup_replicas[node] = std::make_unique<LookupTables>(lookups);
+            }
+        });
+        for (std::size_t w = 0; w < worker_nodes.size(); ++w) {
+            worker_lookups[w] = lookup_replicas[worker_nodes[w]].get();
+        }
+    }
+
+    split_threshold = ROLLOUT_SPLIT_FACTOR * static_cast<std::size_t>(pool->size());
+    rollout_totals = std::make_unique<std::atomic<double>[]>(static_cast<std::size_t>(pool->size()));
+
+    resize(config);
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::resize(const Config& config) {
     const int max_beam_size = config.get_max_beam_size();
     const int max_ops = config.get_length_upper_bound();
 
-    beam.assign(max_beam_size, std::vector<Operation>(max_ops));
-    temp_beam.assign(max_beam_size, std::vector<Operation>(max_ops));
-    beam_successors.reserve(static_cast<std::size_t>(max_beam_size) * config.get_branching_factor());
-    candidates.reserve(static_cast<std::size_t>(max_beam_size) * config.get_branching_factor());
+    beam_stride = static_cast<std::size_t>(max_ops);
+    beam.resize(static_cast<std::size_t>(max_beam_size) * beam_stride);
+    temp_beam.resize(static_cast<std::size_t>(max_beam_size) * beam_stride);
+
+    // Every parent has at most branching_factor successors. With --spill-dir this
+    // only reserves file space, which is allocated as it is written.
+    const std::size_t max_candidates = static_cast<std::size_t>(max_beam_size) * config.get_branching_factor();
+    beam_successors.reserve(static_cast<std::size_t>(max_beam_size));
+    selected_scores.reserve(static_cast<std::size_t>(max_beam_size));
+    candidates.reserve(max_candidates);
+    active.reserve(max_candidates);
+    if (!candidates.spilled()) {
+        candidate_hashes.reserve(max_candidates);
+    } else {
+        candidates_sorted.reserve(max_candidates);
+        active_sorted.reserve(max_candidates);
+    }
 }
 
-inline void BeamSearchContext::copy_candidates_to_successors(
-    std::vector<StateSuccessor>& successors,
-    const std::vector<CandidateSuccessor>& candidates,
-    const std::vector<double>& scores,
-    size_t count) {
-
-    successors.resize(count);
+template<int NetSize>
+inline void BeamSearchContext<NetSize>::copy_candidates_to_successors(size_t count, bool scored) {
+    beam_successors.resize(count);
     for (size_t i = 0; i < count; ++i) {
-        successors[i].beam_index = candidates[i].beam_index;
-        successors[i].operation.op1 = candidates[i].op1;
-        successors[i].operation.op2 = candidates[i].op2;
-        successors[i].score = scores.empty() ? 0.0 : scores[i];
+        const auto& cand = candidates[active[i].index];
+        beam_successors[i].beam_index = cand.beam_index;
+        beam_successors[i].operation = Comparators<NetSize>::OPS[cand.comparator];
+        beam_successors[i].score = scored ? active[i].score : 0.0;
+    }
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::reconstruct_state(State<NetSize>& state, const State<NetSize>& start_state,
+                                                   std::size_t beam_index, int level,
+                                                   const LookupTables& lookups) const {
+    state = start_state;
+    state.apply_operations(beam_entry(beam_index) + start_state.current_level,
+                           level - start_state.current_level, lookups);
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::flush_candidates(WorkerArena& arena) {
+    const std::size_t offset = candidate_count.fetch_add(arena.candidates.size(), std::memory_order_relaxed);
+    std::copy(arena.candidates.begin(), arena.candidates.end(), candidates.data() + offset);
+    arena.candidates.clear();
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::sort_active(std::size_t count, std::size_t keep) {
+    auto by_score = [](const ScoredCandidate& a, const ScoredCandidate& b) { return a.score < b.score; };
+
+    if (!active.spilled()) {
+        std::sort(active.begin(), active.begin() + static_cast<std::ptrdiff_t>(count), by_score);
+        return;
+    }
+
+    // Only the first keep records are needed, so the merge stops there
+    auto never = [](const ScoredCandidate&, const ScoredCandidate&) { return false; };
+    active_sorted.resize(count);
+    sort_merge(*pool, active.data(), count, active_sorted.data(), keep,
+               SPILL_RUN_BYTES / sizeof(ScoredCandidate), by_score, never);
+    active.swap(active_sorted);
+    active.resize(count);
+}
+
+template<int NetSize>
+WorkCounters BeamSearchContext<NetSize>::collect_work_counters() {
+    pool->run_on_each_worker([&](int worker) {
+        arenas[worker]->work = work_counters;
+        work_counters = WorkCounters{};
+    });
+
+    WorkCounters total;
+    for (const auto& arena : arenas) total += arena->work;
+    return total;
+}
+
+template<int NetSize>
+PerfCounts BeamSearchContext<NetSize>::read_perf_counters() const {
+    PerfCounts counts;
+    for (const auto& arena : arenas) arena->perf.read_into(counts);
+    return counts;
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::set_tracer(Tracer* new_tracer) {
+    tracer = new_tracer;
+    tracer->set_num_workers(pool->size());
+    pool->run_on_each_worker([&](int worker) { tracer->allocate_buffer(worker); });
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::set_snapshot_levels(const std::vector<int>& levels, const std::string& dir) {
+    snapshot_levels = levels;
+    snapshot_dir = dir;
+}
+
+template<int NetSize>
+LevelSnapshot BeamSearchContext<NetSize>::capture_level(int level, const State<NetSize>& start_state,
+                                                        const Config& config) const {
+    LevelSnapshot snapshot;
+    snapshot.net_size = NetSize;
+    snapshot.max_beam_size = config.get_max_beam_size();
+    snapshot.num_scoring_tests = config.get_num_scoring_iterations();
+    snapshot.use_symmetry = config.get_use_symmetry_heuristic() ? 1 : 0;
+    snapshot.depth_weight = config.get_depth_weight();
+    snapshot.level = level;
+    snapshot.prefix_length = start_state.current_level;
+    snapshot.beam_size = current_beam_size;
+    snapshot.num_generated = num_generated;
+
+    snapshot.beam.resize(static_cast<std::size_t>(current_beam_size) * static_cast<std::size_t>(level));
+    for (std::size_t i = 0; i < static_cast<std::size_t>(current_beam_size); ++i) {
+        std::copy(beam_entry(i), beam_entry(i) + level, snapshot.beam.data() + i * static_cast<std::size_t>(level));
+    }
+    snapshot.candidates.assign(candidates.data(), candidates.data() + candidates.size());
+    return snapshot;
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::load_level(const LevelSnapshot& snapshot) {
+    current_beam_size = snapshot.beam_size;
+    for (std::size_t i = 0; i < static_cast<std::size_t>(snapshot.beam_size); ++i) {
+        std::copy(snapshot.beam_entry(i), snapshot.beam_entry(i) + snapshot.level, beam.data() + i * beam_stride);
+    }
+    candidates.resize(snapshot.candidates.size());
+    std::copy(snapshot.candidates.begin(), snapshot.candidates.end(), candidates.data());
+    num_generated = snapshot.num_generated;
+    beam_successors.clear();
+    level_metrics = LevelMetrics{};
+    level_metrics.level = snapshot.level;
+    level_metrics.beam_size = snapshot.beam_size;
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::write_requested_snapshot(int level, const State<NetSize>& start_state,
+                                                          const Config& config) {
+    auto it = std::find(snapshot_levels.begin(), snapshot_levels.end(), level);
+    if (it == snapshot_levels.end()) return;
+    snapshot_levels.erase(it);
+
+    // A snapshot that cannot be written is reported, but does not stop the search
+    const std::string path = snapshot_path(snapshot_dir, NetSize, level);
+    try {
+        write_snapshot(path, capture_level(level, start_state, config));
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: " << e.what() << std::endl;
+    }
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::set_checkpoint(const std::string& path, double interval_seconds,
+                                                const SearchCheckpoint* progress) {
+    checkpoint_path = path;
+    checkpoint_interval = interval_seconds;
+    checkpoint_progress = progress;
+    checkpoint_clock = std::chrono::steady_clock::now();
+    last_checkpoint = checkpoint_clock;
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::save_checkpoint(const Config& config, int level) {
+    if (checkpoint_progress == nullptr) return;
+
+    SearchCheckpoint checkpoint;
+    checkpoint.net_size = NetSize;
+    checkpoint.max_beam_size = config.get_max_beam_size();
+    checkpoint.num_scoring_tests = config.get_num_scoring_iterations();
+    checkpoint.use_symmetry = config.get_use_symmetry_heuristic() ? 1 : 0;
+    checkpoint.depth_weight = config.get_depth_weight();
+    checkpoint.two_layer_prefixes = config.get_use_two_layer_prefixes() ? 1 : 0;
+    checkpoint.iteration = checkpoint_progress->iteration;
+    checkpoint.elapsed_seconds = checkpoint_progress->elapsed_seconds + seconds_since(checkpoint_clock);
+    checkpoint.best_length = checkpoint_progress->best_length;
+    checkpoint.best_depth = checkpoint_progress->best_depth;
+    checkpoint.best = checkpoint_progress->best;
+    checkpoint.prefix = checkpoint_progress->prefix;
+    if (level > 0) {
+        checkpoint.level = level;
+        checkpoint.beam_size = current_beam_size;
+        checkpoint.beam.resize(static_cast<std::size_t>(current_beam_size) * static_cast<std::size_t>(level));
+        for (std::size_t i = 0; i < static_cast<std::size_t>(current_beam_size); ++i) {
+            std::copy(beam_entry(i), beam_entry(i) + level, checkpoint.beam.data() + i * static_cast<std::size_t>(level));
+        }
+    }
+
+    // Each worker's generator is thread-local, so each worker saves its own
+    checkpoint.rng_states.resize(arenas.size());
+    pool->run_on_each_worker([&](int worker) { checkpoint.rng_states[worker] = State<NetSize>::save_thread_rng(); });
+
+    // A checkpoint that cannot be written is reported, but does not stop the search
+    try {
+        write_checkpoint(checkpoint_path, checkpoint);
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: " << e.what() << std::endl;
+    }
+    last_checkpoint = std::chrono::steady_clock::now();
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::resume_from(const SearchCheckpoint& checkpoint) {
+    if (checkpoint.rng_states.size() == arenas.size()) {
+        pool->run_on_each_worker([&](int worker) { State<NetSize>::load_thread_rng(checkpoint.rng_states[worker]); });
+    } else {
+        std::cerr << "Warning: the checkpoint was written with " << checkpoint.rng_states.size()
+                  << " worker(s), so the random number generators are not restored" << std::endl;
     }
+
+    if (checkpoint.beam_size == 0) return;
+    if (static_cast<std::size_t>(checkpoint.level) >= beam_stride ||
+        static_cast<std::size_t>(checkpoint.beam_size) * beam_stride > beam.size()) {
+        throw std::invalid_argument("The checkpoint's beam does not fit the configured beam size and length bound");
+    }
+    current_beam_size = checkpoint.beam_size;
+    for (std::size_t i = 0; i < static_cast<std::size_t>(checkpoint.beam_size); ++i) {
+        if (!starts_with_operations(checkpoint.beam_entry(i), checkpoint.prefix)) {
+            throw std::invalid_argument("The checkpoint's beam does not start from its prefix");
+        }
+        std::copy(checkpoint.beam_entry(i), checkpoint.beam_entry(i) + checkpoint.level, beam.data() + i * beam_stride);
+    }
+    resume_level = checkpoint.level;
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::begin_phase() {
+    phase_start_time = std::chrono::steady_clock::now();
+    if (perf_enabled) phase_start_perf = read_perf_counters();
+    if (tracer != nullptr) phase_start_ns = tracer->now();
+    if constexpr (ALLOCATION_TRACKING) phase_start_allocations = read_allocation_counts();
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::end_phase(SearchPhase phase) {
+    static_assert(static_cast<int>(TRACE_REBUILD) == static_cast<int>(PHASE_REBUILD));
+    if (tracer != nullptr) {
+        tracer->record(0, static_cast<TraceKind>(phase), static_cast<std::uint32_t>(level_metrics.level), phase_start_ns);
+    }
+    level_metrics.seconds[phase] += seconds_since(phase_start_time);
+    if constexpr (ALLOCATION_TRACKING) {
+        AllocCounts counts = read_allocation_counts();
+        counts -= phase_start_allocations;
+        level_metrics.allocations[phase] += counts;
+    }
+    if (perf_enabled) {
+        PerfCounts counts = read_perf_counters();
+        counts -= phase_start_perf;
+        level_metrics.perf[phase] += counts;
+        perf_totals[phase] += counts;
+    }
+}
+
+template<int NetSize>
+void BeamSearchContext<NetSize>::write_level_metrics(LevelObserver& metrics) {
+    if constexpr (ALLOCATION_TRACKING) {
+        level_metrics.level_allocations = read_allocation_counts();
+        level_metrics.level_allocations -= level_start_allocations;
+    }
+    level_metrics.work = collect_work_counters();
+    level_metrics.selected = beam_successors.size();
+
+    selected_scores.clear();
+    if (level_metrics.halving_rounds > 0) {
+        // beam_successors is ordered best (lowest score) first
+        for (const auto& successor : beam_successors) selected_scores.push_back(successor.score);
+    }
+    summarize_scores(level_metrics, selected_scores);
+
+    level_metrics.peak_rss_bytes = peak_rss_bytes();
+    metrics.on_level(level_metrics);
 }
 
 // Beam search algorithm for finding optimal sorting networks.
@@ -143,49 +672,81 @@ inline void BeamSearchContext::copy_candidates_to_successors(
 // 3. Keep the best candidates (up to beam_size) for the next level
 // 4. Repeat until a complete sorting network is found
 //
-// Uses parallel candidate collection and scoring with OpenMP.
+// The search starts at level start_state.current_level with a single beam entry
+// holding the start state's operations. Every state reconstruction copies
+// start_state and replays only the operations after it.
+//
+// Uses parallel candidate collection and scoring on the worker pool.
 template<int NetSize>
-int BeamSearchContext::beam_search(State<NetSize>& result, const Config& config, const LookupTables& lookups) {
-    const int net_size = config.get_net_size();
+int BeamSearchContext<NetSize>::beam_search(State<NetSize>& result, const State<NetSize>& start_state,
+                                            const Config& config, const LookupTables& lookups,
+                                            LevelObserver* metrics) {
     const int max_beam_size = config.get_max_beam_size();
     const int max_ops = config.get_length_upper_bound();
     const bool use_symmetry = config.get_use_symmetry_heuristic();
 
-    if (static_cast<int>(beam.size()) != max_beam_size ||
-        (beam.size() > 0 && static_cast<int>(beam[0].size()) != max_ops)) {
+    if (beam_stride != static_cast<std::size_t>(max_ops) ||
+        beam.size() != static_cast<std::size_t>(max_beam_size) * beam_stride) {
         resize(config);
     }
 
-    current_beam_size = 1;
+    // A resumed search continues from the beam restored by resume_from()
+    int first_level = start_state.current_level;
+    if (resume_level >= 0) {
+        first_level = resume_level;
+        resume_level = -1;
+    } else {
+        current_beam_size = 1;
+        std::copy(start_state.operations.begin(), start_state.operations.begin() + start_state.current_level,
+                  beam.data());
+    }
+
+    // Work done before the search (e.g. applying the prefix) is not counted
+    if (metrics != nullptr) collect_work_counters();
 
-    for (int level = 0; ; ++level) {
+    for (int level = first_level; ; ++level) {
+        TraceSpan level_span(tracer, 0, TRACE_LEVEL, static_cast<std::size_t>(level));
         std::cout << level;
         std::cout.flush();
 
         beam_successors.clear();
         candidates.clear();
+        level_metrics = LevelMetrics{};
+        level_metrics.level = level;
+        level_metrics.beam_size = current_beam_size;
+        if constexpr (ALLOCATION_TRACKING) level_start_allocations = read_allocation_counts();
+        SN_PROBE2(level_start, level, current_beam_size);
 
         PROFILE_START(successor_gen);
         PROFILE_START(candidate_collection);
+        begin_phase();
 
-        // Phase 1: Collect candidates in parallel
-        int completed_index = collect_candidates_parallel<NetSize>(level, net_size, use_symmetry,
-                                                                    config, lookups);
+        // Phase 1: Collect and deduplicate candidates in parallel
+        int completed_index = collect_candidates_parallel(level, use_symmetry, start_state, config);
 
+        end_phase(PHASE_COLLECT);
         PROFILE_END(candidate_collection, "Candidate collection (parallel)");
 
-        // Phase 2: Deduplicate candidates
-        auto [before, after] = deduplicate_candidates();
+        const std::size_t before = num_generated;
+        const std::size_t after = candidates.size();
+        level_metrics.generated = before;
+        level_metrics.unique = after;
+        SN_PROBE3(dedup, level, before, after);
 
         // Handle completed network found during collection
         if (completed_index != -1) {
             std::cout << std::endl;
-            result.set_start_state(config, lookups);
-            for (int j = 0; j < level; ++j) {
-                result.update_state(beam[completed_index][j].op1, beam[completed_index][j].op2, lookups);
+            reconstruct_state(result, start_state, static_cast<std::size_t>(completed_index), level, lookups);
+            SN_PROBE2(network_found, level, result.get_depth());
+            if (metrics != nullptr) {
+                level_metrics.complete = true;
+                write_level_metrics(*metrics);
             }
             return level;
         }
+        if (cancelled()) return cancel_level(level, config);
+
+        if (!snapshot_levels.empty()) write_requested_snapshot(level, start_state, config);
 
         // Print reduction stats
         if (before == after) {
@@ -194,163 +755,174 @@ int BeamSearchContext::beam_search(State<NetSize>& result, const Config& config,
             std::cout << " [" << before << "\u2192" << after << "] ";
         }
 
-        // Phase 3: Select best candidates
-        select_best_candidates<NetSize>(level, max_beam_size, config, lookups);
+        // Phase 2: Select best candidates
+        select_best_candidates(level, max_beam_size, start_state, config);
+        if (cancelled()) return cancel_level(level, config);
 
         PROFILE_END(successor_gen, "Successor generation (incl parallel scoring)");
         PROFILE_START(reconstruction);
+        begin_phase();
 
-        // Phase 4: Rebuild beam
+        // Phase 3: Rebuild beam
         rebuild_beam(level);
 
+        end_phase(PHASE_REBUILD);
         PROFILE_END(reconstruction, "Beam reconstruction");
+        SN_PROBE2(level_end, level, current_beam_size);
+
+        if (metrics != nullptr) write_level_metrics(*metrics);
+
+        if (checkpoint_progress != nullptr && seconds_since(last_checkpoint) >= checkpoint_interval) {
+            save_checkpoint(config, level + 1);
+        }
     }
 }
 
 template<int NetSize>
-int BeamSearchContext::collect_candidates_parallel(int level, int net_size, bool use_symmetry,
-                                                    const Config& config, const LookupTables& lookups) {
-    int completed_index = -1;
-
-    #pragma omp parallel
-    {
-        // Thread-local storage for candidates to avoid synchronization
-        thread_local std::vector<CandidateSuccessor> local_candidates;
-        local_candidates.clear();
-        local_candidates.reserve(256);
-
-        // Thread-local state for reconstruction
-        thread_local State<NetSize> thread_state(config);
-        thread_local std::vector<std::vector<int>> thread_succ_ops;
-        thread_local std::vector<Operation> thread_ops;
-        if (thread_succ_ops.empty()) {
-            thread_succ_ops.reserve(net_size);
-            for (int i = 0; i < net_size; ++i) {
-                thread_succ_ops.emplace_back(net_size, 0);
-            }
-        }
+int BeamSearchContext<NetSize>::cancel_level(int level, const Config& config) {
+    std::cout << std::endl;
+    // At level 0 nothing is lost, and the last checkpoint is still the right one
+    if (checkpoint_progress != nullptr && level > 0) save_checkpoint(config, level);
+    return SEARCH_CANCELLED;
+}
 
-        #pragma omp for schedule(dynamic)
-        for (int i = 0; i < current_beam_size; ++i) {
-            // Check if another thread already found a complete network
-            if (completed_index != -1) continue;
+template<int NetSize>
+int BeamSearchContext<NetSize>::collect_candidates_parallel(int level, bool use_symmetry,
+                                                            const State<NetSize>& start_state,
+                                                            const Config& config) {
+    std::atomic<int> completed_index{-1};
+    const bool spilled = candidates.spilled();
+    const std::size_t max_candidates = static_cast<std::size_t>(current_beam_size) * config.get_branching_factor();
+
+    if (!spilled) {
+        TraceSpan span(tracer, 0, TRACE_DEDUP, static_cast<std::size_t>(level));
+        candidate_hashes.reserve(max_candidates);
+        pool->parallel_for(candidate_hashes.num_slots(), 4096, [&](int, std::size_t slot) {
+            candidate_hashes.clear_slot(slot);
+        });
+    }
 
-            // Reconstruct state for this beam entry
-            thread_state.set_start_state(config, lookups);
-            for (int j = 0; j < level; ++j) {
-                thread_state.update_state(beam[i][j].op1, beam[i][j].op2, lookups);
-            }
+    // Workers copy candidates into slots they claim from candidate_count
+    candidates.resize(max_candidates);
+    candidate_count.store(0, std::memory_order_relaxed);
+    for (auto& arena : arenas) {
+        arena->candidates.clear();
+        arena->generated = 0;
+    }
 
-            // Clear successor matrix
-            for (auto& row : thread_succ_ops) {
-                std::fill(row.begin(), row.end(), 0);
-            }
-            int num_succs = thread_state.find_successors(thread_succ_ops, net_size);
-
-            // Check for complete network
-            if (num_succs == 0) {
-                #pragma omp critical
-                {
-                    if (completed_index == -1) {
-                        completed_index = i;
-                    }
-                }
-                continue;
+    pool->parallel_for(static_cast<std::size_t>(current_beam_size), 1, [&](int worker, std::size_t i) {
+        // Check if another worker already found a complete network, or the search was cancelled
+        if (completed_index.load(std::memory_order_relaxed) != -1 || cancelled()) return;
+
+        TraceSpan span(tracer, worker, TRACE_EXPAND, i);
+        WorkerArena& arena = *arenas[worker];
+        const LookupTables& local_lookups = *worker_lookups[worker];
+
+        // Keep a candidate only if no worker has generated an isomorphic one yet
+        // (spilled candidates are all kept, and deduplicated afterwards)
+        auto add_candidate = [&](int n1, int n2) {
+            std::uint64_t hash = build_operation_sequence<NetSize>(
+                arena.ops, beam_entry(i), level,
+                static_cast<std::uint8_t>(n1),
+                static_cast<std::uint8_t>(n2));
+            arena.generated++;
+            if (spilled || candidate_hashes.insert(hash)) {
+                arena.candidates.push_back(CandidateSuccessor{hash,
+                                                              static_cast<std::uint32_t>(i),
+                                                              static_cast<std::uint16_t>(Comparators<NetSize>::index(n1, n2))});
+                if (arena.candidates.size() >= CANDIDATE_FLUSH_SIZE) flush_candidates(arena);
             }
+        };
 
-            // Symmetry heuristic
-            bool skip_search = false;
-            if (use_symmetry && level >= 1) {
-                int n1 = beam[i][level - 1].op1;
-                int n2 = beam[i][level - 1].op2;
-                int inv_n1 = (net_size - 1) - n2;
-                int inv_n2 = (net_size - 1) - n1;
-
-                if (n1 != (net_size - 1) - n1 && n1 != (net_size - 1) - n2 &&
-                    n2 != (net_size - 1) - n1 && n2 != (net_size - 1) - n2 &&
-                    thread_succ_ops[inv_n1][inv_n2] == 1) {
-                    std::uint64_t hash = build_operation_sequence<NetSize>(
-                        thread_ops, beam[i], level,
-                        static_cast<std::uint8_t>(inv_n1),
-                        static_cast<std::uint8_t>(inv_n2),
-                        net_size);
-                    local_candidates.push_back(CandidateSuccessor{static_cast<std::size_t>(i),
-                                                                 static_cast<std::uint8_t>(inv_n1),
-                                                                 static_cast<std::uint8_t>(inv_n2),
-                                                                 hash});
-                    skip_search = true;
-                }
-            }
+        // Reconstruct state for this beam entry
+        reconstruct_state(arena.state, start_state, i, level, local_lookups);
 
-            // Collect valid successors
-            if (!skip_search) {
-                for (int n1 = 0; n1 < net_size - 1; ++n1) {
-                    for (int n2 = n1 + 1; n2 < net_size; ++n2) {
-                        if (thread_succ_ops[n1][n2] == 1) {
-                            std::uint64_t hash = build_operation_sequence<NetSize>(
-                                thread_ops, beam[i], level,
-                                static_cast<std::uint8_t>(n1),
-                                static_cast<std::uint8_t>(n2),
-                                net_size);
-                            local_candidates.push_back(CandidateSuccessor{static_cast<std::size_t>(i),
-                                                                         static_cast<std::uint8_t>(n1),
-                                                                         static_cast<std::uint8_t>(n2),
-                                                                         hash});
-                        }
-                    }
-                }
-            }
-        }
+        int num_succs = arena.state.find_successors(arena.succ_rows);
 
-        // Merge thread-local candidates into global list
-        #pragma omp critical
-        {
-            candidates.insert(candidates.end(), local_candidates.begin(), local_candidates.end());
+        // Check for complete network
+        if (num_succs == 0) {
+            int expected = -1;
+            completed_index.compare_exchange_strong(expected, static_cast<int>(i), std::memory_order_relaxed);
+            return;
         }
-    }
 
-    return completed_index;
-}
+        // Symmetry heuristic
+        bool skip_search = false;
+        if (use_symmetry && level >= 1) {
+            int n1 = beam_entry(i)[level - 1].op1;
+            int n2 = beam_entry(i)[level - 1].op2;
+            int inv_n1 = (NetSize - 1) - n2;
+            int inv_n2 = (NetSize - 1) - n1;
+
+            if (n1 != (NetSize - 1) - n1 && n1 != (NetSize - 1) - n2 &&
+                n2 != (NetSize - 1) - n1 && n2 != (NetSize - 1) - n2 &&
+                ((arena.succ_rows[inv_n1] >> inv_n2) & 1)) {
+                add_candidate(inv_n1, inv_n2);
+                skip_search = true;
+            }
+        }
 
-std::pair<std::size_t, std::size_t> BeamSearchContext::deduplicate_candidates() {
-    std::size_t before = candidates.size();
-    if (!candidates.empty()) {
-        std::unordered_map<std::uint64_t, std::size_t> hash_to_index;
-        hash_to_index.reserve(candidates.size() * 2);
-
-        std::size_t unique = 0;
-        for (std::size_t i = 0; i < candidates.size(); ++i) {
-            auto [it, inserted] = hash_to_index.try_emplace(candidates[i].canonical_hash, i);
-            if (inserted) {
-                if (unique != i) {
-                    candidates[unique] = candidates[i];
+        // Collect valid successors
+        if (!skip_search) {
+            for (int n1 = 0; n1 < NetSize - 1; ++n1) {
+                for (auto row = arena.succ_rows[n1]; row != 0; row &= static_cast<decltype(row)>(row - 1)) {
+                    add_candidate(n1, std::countr_zero(row));
                 }
-                unique++;
             }
         }
-        candidates.resize(unique);
+    });
+
+    // Copy the remaining per-worker candidates into the global list
+    num_generated = 0;
+    for (auto& arena : arenas) {
+        num_generated += arena->generated;
+        flush_candidates(*arena);
+    }
+    candidates.resize(candidate_count.load(std::memory_order_relaxed));
+
+    // A cancelled level is abandoned, so skip the external sort of its candidates
+    if (spilled && completed_index.load() == -1 && !cancelled()) {
+        TraceSpan span(tracer, 0, TRACE_DEDUP, static_cast<std::size_t>(level));
+
+        // Deduplicate by sorting on the canonical hash. Of each group of
+        // isomorphic candidates, the one with the lowest parent and comparator is kept.
+        auto by_hash = [](const CandidateSuccessor& a, const CandidateSuccessor& b) {
+            return std::tie(a.canonical_hash, a.beam_index, a.comparator) <
+                   std::tie(b.canonical_hash, b.beam_index, b.comparator);
+        };
+        auto same_hash = [](const CandidateSuccessor& a, const CandidateSuccessor& b) {
+            return a.canonical_hash == b.canonical_hash;
+        };
+        candidates_sorted.resize(candidates.size());
+        const std::size_t num_unique = sort_merge(*pool, candidates.data(), candidates.size(), candidates_sorted.data(),
+                                                  candidates.size(), SPILL_RUN_BYTES / sizeof(CandidateSuccessor),
+                                                  by_hash, same_hash);
+        candidates.swap(candidates_sorted);
+        candidates.resize(num_unique);
     }
-    std::size_t after = candidates.size();
-    return {before, after};
+
+    return completed_index.load();
 }
 
 template<int NetSize>
-void BeamSearchContext::select_best_candidates(int level, int max_beam_size,
-                                                const Config& config, const LookupTables& lookups) {
+void BeamSearchContext<NetSize>::select_best_candidates(int level, int max_beam_size,
+                                                        const State<NetSize>& start_state,
+                                                        const Config& config) {
     const double depth_weight = config.get_depth_weight();
 
+    active.resize(candidates.size());
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        active[i] = ScoredCandidate{0.0, i};
+    }
+
     if (candidates.size() <= static_cast<size_t>(max_beam_size)) {
         // No halving needed - copy all candidates directly
-        copy_candidates_to_successors(beam_successors, candidates, {}, candidates.size());
+        copy_candidates_to_successors(candidates.size(), false);
         return;
     }
 
     // Phase 2: Successive Halving Algorithm
     // Implements Algorithm 1 from "Sequential Halving" paper
-    std::vector<size_t> active_indices(candidates.size());
-    for (size_t i = 0; i < candidates.size(); ++i) {
-        active_indices[i] = i;
-    }
 
     // Calculate rounds until beam_size: ceil(log2(initial_candidates / max_beam_size))
     size_t initial_count = candidates.size();
@@ -368,85 +940,118 @@ void BeamSearchContext::select_best_candidates(int level, int max_beam_size,
         static_cast<double>(base_num_tests) / num_rounds
     ));
 
-    // Scores from current round only (not accumulated)
-    std::vector<double> scores(candidates.size());
-
     // Keep halving until we can't without going below beam_size
     int round = 0;
-    while (active_indices.size() > static_cast<size_t>(max_beam_size)) {
+    while (active.size() > static_cast<size_t>(max_beam_size)) {
         round++;
+        level_metrics.halving_rounds = round;
+        SN_PROBE4(halving_start, level, round, active.size(), tests_per_candidate);
+        begin_phase();
 
         // Print tests per candidate for this round
         std::cout << "{" << tests_per_candidate << "} ";
 
-        // Run fresh tests for each active candidate (no accumulation)
-        #pragma omp parallel
-        {
-            thread_local State<NetSize> thread_state(config);
-
-            #pragma omp for schedule(dynamic)
-            for (std::size_t idx = 0; idx < active_indices.size(); ++idx) {
-                size_t cand_idx = active_indices[idx];
-                const auto& cand = candidates[cand_idx];
+        // Scores are from the current round only (not accumulated)
+        if (active.size() < split_threshold) {
+            // Few candidates: reconstruct a batch of them, one per worker, then spread
+            // the batch's rollouts over all workers
+            const std::size_t num_active = active.size();
+            if (candidate_states.empty()) {
+                candidate_states.resize(static_cast<std::size_t>(pool->size()), State<NetSize>(config));
+            }
+            const std::size_t batch_size = candidate_states.size();
 
-                thread_state.set_start_state(config, lookups);
-                for (int j = 0; j < level; ++j) {
-                    thread_state.update_state(beam[cand.beam_index][j].op1,
-                                              beam[cand.beam_index][j].op2, lookups);
+            for (std::size_t first = 0; first < num_active; first += batch_size) {
+                const std::size_t batch = std::min(batch_size, num_active - first);
+                const std::size_t num_rollouts = batch * static_cast<std::size_t>(tests_per_candidate);
+                for (std::size_t idx = 0; idx < batch; ++idx) {
+                    rollout_totals[idx].store(0.0, std::memory_order_relaxed);
                 }
-                thread_state.update_state(cand.op1, cand.op2, lookups);
 
-                // Run fixed number of tests and get mean score
-                double score = thread_state.score_state(tests_per_candidate, depth_weight, lookups);
-                #pragma omp critical
-                {
-                    scores[cand_idx] = score;
+                pool->parallel_for(batch, 1, [&](int worker, std::size_t idx) {
+                    if (cancelled()) return;
+                    TraceSpan span(tracer, worker, TRACE_RECONSTRUCT, first + idx);
+                    const LookupTables& local_lookups = *worker_lookups[worker];
+                    const auto& cand = candidates[active[first + idx].index];
+                    const Operation op = Comparators<NetSize>::OPS[cand.comparator];
+                    auto& cand_state = candidate_states[idx];
+
+                    reconstruct_state(cand_state, start_state, cand.beam_index, level, local_lookups);
+                    cand_state.update_state(op.op1, op.op2, local_lookups);
+                });
+
+                pool->parallel_for(num_rollouts, 1, [&](int worker, std::size_t r) {
+                    if (cancelled()) return;
+                    TraceSpan span(tracer, worker, TRACE_ROLLOUT, r);
+                    const std::size_t idx = r / tests_per_candidate;
+                    rollout_totals[idx].fetch_add(candidate_states[idx].rollout_score(
+                        arenas[worker]->rollout_state, depth_weight, *worker_lookups[worker], cancel_flag),
+                        std::memory_order_relaxed);
+                });
+
+                for (std::size_t idx = 0; idx < batch; ++idx) {
+                    active[first + idx].score = rollout_totals[idx].load(std::memory_order_relaxed) / tests_per_candidate;
                 }
             }
+        } else {
+            // Run fresh tests for each active candidate (no accumulation)
+            pool->parallel_for(active.size(), 1, [&](int worker, std::size_t idx) {
+                if (cancelled()) return;
+                TraceSpan span(tracer, worker, TRACE_SCORE_CANDIDATE, idx);
+                const auto& cand = candidates[active[idx].index];
+                const Operation op = Comparators<NetSize>::OPS[cand.comparator];
+                WorkerArena& arena = *arenas[worker];
+                const LookupTables& local_lookups = *worker_lookups[worker];
+
+                reconstruct_state(arena.state, start_state, cand.beam_index, level, local_lookups);
+                arena.state.update_state(op.op1, op.op2, local_lookups);
+
+                // Each record is written by exactly one task, so no locking is needed
+                active[idx].score = arena.state.score_state(tests_per_candidate, depth_weight,
+                                                            arena.rollout_state, local_lookups, cancel_flag);
+            });
         }
 
-        // Sort active candidates by score (lower is better)
-        std::sort(active_indices.begin(), active_indices.end(),
-                  [&scores](size_t a, size_t b) { return scores[a] < scores[b]; });
+        end_phase(PHASE_SCORE);
+        // The scores of a cancelled round are incomplete, and beam_search() stops
+        if (cancelled()) return;
+        begin_phase();
+
+        // Sort active candidates by score (lower is better). Only the survivors of
+        // this round are needed, or the final beam if halving stops here.
+        const size_t num_active = active.size();
+        size_t new_size = num_active / 2;
+        sort_active(num_active, std::min(num_active, std::max(new_size, static_cast<size_t>(max_beam_size))));
+        end_phase(PHASE_SORT);
 
         // Keep top 50% (but ensure we don't go below max_beam_size)
-        size_t new_size = active_indices.size() / 2;
         if (new_size < static_cast<size_t>(max_beam_size)) {
+            SN_PROBE3(halving_end, level, round, std::min(num_active, static_cast<size_t>(max_beam_size)));
             break;
         }
-        active_indices.resize(new_size);
+        SN_PROBE3(halving_end, level, round, new_size);
+        active.resize(new_size);
 
         // Double tests for next round
         tests_per_candidate *= 2;
     }
 
-    // Build final beam_successors from active candidates
-    size_t final_size = std::min(active_indices.size(), static_cast<size_t>(max_beam_size));
-
-    // Extract selected candidates and scores via active_indices
-    std::vector<CandidateSuccessor> selected_candidates;
-    std::vector<double> selected_scores;
-    selected_candidates.reserve(final_size);
-    selected_scores.reserve(final_size);
-    for (size_t i = 0; i < final_size; ++i) {
-        size_t cand_idx = active_indices[i];
-        selected_candidates.push_back(candidates[cand_idx]);
-        selected_scores.push_back(scores[cand_idx]);
-    }
-    copy_candidates_to_successors(beam_successors, selected_candidates, selected_scores,
-                                  final_size);
+    // Build final beam_successors from the best active candidates
+    size_t final_size = std::min(active.size(), static_cast<size_t>(max_beam_size));
+    copy_candidates_to_successors(final_size, true);
 }
 
-void BeamSearchContext::rebuild_beam(int level) {
+template<int NetSize>
+void BeamSearchContext<NetSize>::rebuild_beam(int level) {
     current_beam_size = static_cast<int>(beam_successors.size());
 
-    for (int i = 0; i < current_beam_size; ++i) {
-        for (int j = 0; j < level; ++j)
-            temp_beam[i][j] = beam[beam_successors[i].beam_index][j];
-        temp_beam[i][level] = beam_successors[i].operation;
-    }
+    pool->parallel_for(beam_successors.size(), 256, [&](int, std::size_t i) {
+        const Operation* parent = beam_entry(beam_successors[i].beam_index);
+        Operation* entry = temp_beam.data() + i * beam_stride;
+        std::copy(parent, parent + level, entry);
+        entry[level] = beam_successors[i].operation;
+    });
 
-    for (int i = 0; i < current_beam_size; ++i)
-        for (int j = 0; j <= level; ++j)
-            beam[i][j] = temp_beam[i][j];
+    // The new level becomes the beam; the old one is overwritten next level
+    beam.swap(temp_beam);
 }
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "types.h"
+#include "file_sync.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Snapshots of a search level for --snapshot-levels, replayed by the replay
+// benchmark to time the phases of a level on a real workload.
+//
+// A snapshot holds the parameters the phases depend on, the beam the level
+// expands (each entry's first level operations, including the prefix), and
+// the level's candidates after deduplication. The file is a small header
+// followed by both arrays as raw records:
+//
+//   "SNLEVEL1", net_size, max_beam_size, num_scoring_tests, use_symmetry,
+//   depth_weight, level, prefix_length, beam_size, num_generated,
+//   num_candidates, beam operations, candidates
+//
+// It is written to a temporary file, synced and renamed into place (see
+// file_sync.h), so a snapshot file is always complete, even after a crash.
+
+inline constexpr char SNAPSHOT_MAGIC[8] = {'S', 'N', 'L', 'E', 'V', 'E', 'L', '1'};
+
+struct LevelSnapshot {
+    std::int32_t net_size = 0;
+    std::int32_t max_beam_size = 0;
+    std::int32_t num_scoring_tests = 0;
+    std::int32_t use_symmetry = 0;
+    double depth_weight = 0.0;
+    std::int32_t level = 0;
+    std::int32_t prefix_length = 0;          // Operations of the start state
+    std::int32_t beam_size = 0;
+    std::uint64_t num_generated = 0;         // Candidates before deduplication
+    std::vector<Operation> beam;             // beam_size rows of level operations
+    std::vector<CandidateSuccessor> candidates;
+
+    [[nodiscard]] const Operation* beam_entry(std::size_t i) const {
+        return beam.data() + i * static_cast<std::size_t>(level);
+    }
+};
+
+// The first beam_entries entries of a snapshot's beam and their candidates, as
+// a smaller level of the same search (for weak scaling). The beam size and the
+// count of generated candidates shrink in proportion.
+inline LevelSnapshot slice_snapshot(const LevelSnapshot& snapshot, int beam_entries) {
+    LevelSnapshot slice = snapshot;
+    if (beam_entries >= snapshot.beam_size) return slice;
+
+    slice.beam_size = std::max(beam_entries, 1);
+    slice.max_beam_size = std::max(1, static_cast<int>(static_cast<std::int64_t>(snapshot.max_beam_size) *
+                                                       slice.beam_size / snapshot.beam_size));
+    slice.beam.resize(static_cast<std::size_t>(slice.beam_size) * static_cast<std::size_t>(snapshot.level));
+    slice.candidates.clear();
+    for (const CandidateSuccessor& candidate : snapshot.candidates) {
+        if (candidate.beam_index < static_cast<std::uint32_t>(slice.beam_size)) slice.candidates.push_back(candidate);
+    }
+    if (!snapshot.candidates.empty()) {
+        slice.num_generated = snapshot.num_generated * slice.candidates.size() / snapshot.candidates.size();
+    }
+    return slice;
+}
+
+// File name of the snapshot of a level, in dir.
+inline std::string snapshot_path(const std::string& dir, int net_size, int level) {
+    return (dir.empty() ? std::string(".") : dir) + "/n" + std::to_string(net_size) + "-level" +
+           std::to_string(level) + ".snap";
+}
+
+inline void write_snapshot(const std::string& path, const LevelSnapshot& snapshot) {
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot open snapshot file " + temp_path + ": " + std::strerror(errno));
+        }
+        auto put = [&](const auto& value) { out.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+        const std::uint64_t num_candidates = snapshot.candidates.size();
+
+        out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        put(snapshot.net_size);
+        put(snapshot.max_beam_size);
+        put(snapshot.num_scoring_tests);
+        put(snapshot.use_symmetry);
+        put(snapshot.depth_weight);
+        put(snapshot.level);
+        put(snapshot.prefix_length);
+        put(snapshot.beam_size);
+        put(snapshot.num_generated);
+        put(num_candidates);
+        out.write(reinterpret_cast<const char*>(snapshot.beam.data()),
+                  static_cast<std::streamsize>(snapshot.beam.size() * sizeof(Operation)));
+        out.write(reinterpret_cast<const char*>(snapshot.candidates.data()),
+                  static_cast<std::streamsize>(num_candidates * sizeof(CandidateSuccessor)));
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Cannot write snapshot file " + temp_path + ": " + std::strerror(errno));
+        }
+    }
+    replace_file_durably(temp_path, path);
+}
+
+inline LevelSnapshot read_snapshot(const std::string& path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open snapshot file " + path + ": " + std::strerror(errno));
+    }
+    auto get = [&](auto& value) { in.read(reinterpret_cast<char*>(&value), sizeof(value)); };
+
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+        throw std::runtime_error(path + " is not a level snapshot");
+    }
+
+    LevelSnapshot snapshot;
+    std::uint64_t num_candidates = 0;
+    get(snapshot.net_size);
+    get(snapshot.max_beam_size);
+    get(snapshot.num_scoring_tests);
+    get(snapshot.use_symmetry);
+    get(snapshot.depth_weight);
+    get(snapshot.level);
+    get(snapshot.prefix_length);
+    get(snapshot.beam_size);
+    get(snapshot.num_generated);
+    get(num_candidates);
+    if (!in || snapshot.net_size < 2 || snapshot.net_size > MAX_NET_SIZE || snapshot.level < snapshot.prefix_length ||
+        snapshot.prefix_length < 0 || snapshot.beam_size < 1 || snapshot.beam_size > snapshot.max_beam_size ||
+        num_candidates > static_cast<std::uint64_t>(snapshot.beam_size) * Comparators<MAX_NET_SIZE>::COUNT) {
+        throw std::runtime_error("Corrupt header in snapshot file " + path);
+    }
+
+    snapshot.beam.resize(static_cast<std::size_t>(snapshot.beam_size) * static_cast<std::size_t>(snapshot.level));
+    snapshot.candidates.resize(num_candidates);
+    in.read(reinterpret_cast<char*>(snapshot.beam.data()),
+            static_cast<std::streamsize>(snapshot.beam.size() * sizeof(Operation)));
+    in.read(reinterpret_cast<char*>(snapshot.candidates.data()),
+            static_cast<std::streamsize>(num_candidates * sizeof(CandidateSuccessor)));
+    if (!in) {
+        throw std::runtime_error("Snapshot file " + path + " is truncated");
+    }
+    return snapshot;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Out-of-core storage for the large per-level arrays of wide beam searches.
+//
+// SpillArray<T> is a growable array of trivially copyable records. By default it
+// lives in anonymous memory. Given a spill directory, it is backed instead by an
+// unlinked temporary file in that directory, mapped with MAP_SHARED, so the kernel
+// writes cold pages back to disk rather than needing RAM or swap for them. The
+// file disappears when the array is destroyed or the process exits.
+//
+// Capacity is reserved as address space only: pages are allocated (or file blocks
+// written) when first touched, and records that were never written read as zero.
+
+inline constexpr std::size_t SPILL_GRANULE = std::size_t{2} << 20;
+
+template<typename T>
+class SpillArray {
+    static_assert(std::is_trivially_copyable_v<T>, "SpillArray records are copied as raw bytes");
+
+public:
+    SpillArray() = default;
+    explicit SpillArray(const std::string& spill_dir) : spill_dir_(spill_dir) {}
+    ~SpillArray() { release(); }
+
+    SpillArray(SpillArray&& other) noexcept { swap(other); }
+    SpillArray& operator=(SpillArray&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+    SpillArray(const SpillArray&) = delete;
+    SpillArray& operator=(const SpillArray&) = delete;
+
+    void swap(SpillArray& other) noexcept {
+        std::swap(spill_dir_, other.spill_dir_);
+        std::swap(fd_, other.fd_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(mapped_bytes_, other.mapped_bytes_);
+    }
+
+    [[nodiscard]] bool spilled() const { return !spill_dir_.empty(); }
+    [[nodiscard]] std::size_t size() const { return size_; }
+    [[nodiscard]] std::size_t capacity() const { return capacity_; }
+    [[nodiscard]] bool empty() const { return size_ == 0; }
+
+    T* data() { return data_; }
+    const T* data() const { return data_; }
+    T& operator[](std::size_t i) { return data_[i]; }
+    const T& operator[](std::size_t i) const { return data_[i]; }
+    T* begin() { return data_; }
+    T* end() { return data_ + size_; }
+    const T* begin() const { return data_; }
+    const T* end() const { return data_ + size_; }
+
+    void clear() { size_ = 0; }
+
+    // Make room for at least n records, growing the mapping (and file) if needed.
+    void reserve(std::size_t n) {
+        if (n <= capacity_) return;
+        const std::size_t bytes = (n * sizeof(T) + SPILL_GRANULE - 1) / SPILL_GRANULE * SPILL_GRANULE;
+
+        if (spilled()) {
+            if (fd_ < 0) open_file();
+            if (ftruncate(fd_, static_cast<off_t>(bytes)) != 0) {
+                throw std::runtime_error("Cannot grow spill file in " + spill_dir_ + ": " + std::strerror(errno));
+            }
+        }
+
+        void* ptr;
+        if (data_ == nullptr) {
+            ptr = spilled() ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0)
+                            : mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        } else {
+            ptr = mremap(data_, mapped_bytes_, bytes, MREMAP_MAYMOVE);
+        }
+        if (ptr == MAP_FAILED) throw std::bad_alloc();
+
+        data_ = static_cast<T*>(ptr);
+        mapped_bytes_ = bytes;
+        capacity_ = bytes / sizeof(T);
+    }
+
+    // Set the size to n records. Unlike std::vector, records past the old size
+    // are not initialized: they keep whatever was last stored there.
+    void resize(std::size_t n) {
+        if (n > capacity_) reserve(std::max(n, capacity_ * 2));
+        size_ = n;
+    }
+
+private:
+    std::string spill_dir_;
+    int fd_ = -1;
+    T* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = 0;
+    std::size_t mapped_bytes_ = 0;
+
+    void open_file() {
+        std::string path = spill_dir_ + "/sorting_networks.XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+
+        fd_ = mkstemp(name.data());
+        if (fd_ < 0) {
+            throw std::runtime_error("Cannot create spill file in " + spill_dir_ + ": " + std::strerror(errno));
+        }
+        unlink(name.data());
+    }
+
+    void release() {
+        if (data_ != nullptr) munmap(data_, mapped_bytes_);
+        if (fd_ >= 0) close(fd_);
+        data_ = nullptr;
+        fd_ = -1;
+    }
+};
@@ -3,35 +3,49 @@
 #include "config.h"
 #include "lookup.h"
 #include "types.h"
+#include "huge_pages.h"
+#include "metrics.h"
+#include "probes.h"
 #include <vector>
 #include <memory>
 #include <algorithm>
 #include <iostream>
 #include <random>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cstdint>
 
+// Comparators a cancellable rollout adds between checks of its cancel flag, so a
+// long rollout at large n stops soon after cancellation without loading the flag
+// on every comparator.
+inline constexpr int ROLLOUT_CANCEL_INTERVAL = 64;
+
 // State represents the current progress of sorting network construction.
 // It tracks which input patterns have been sorted and which operations have been applied.
 template<int NetSize>
 class State {
 public:
     using PatternType = typename BitStorage<NetSize>::type;
+    using Mask = WireMask<NetSize>;
+
+    // Valid successors, one row per op1: bit op2 of rows[op1] is set if the
+    // comparator (op1, op2) would change at least one unsorted pattern.
+    using SuccessorRows = std::array<Mask, NetSize>;
 
     // ListElement represents a node in the intrusive linked list of unsorted patterns.
     // This is a space-efficient way to track which input patterns still need sorting.
-    struct ListElement {
-        std::uint8_t in_list;      // 1 if this pattern is currently in the unsorted list
-        PatternType bit_pattern;   // The binary pattern value
-        int next;                  // Index of next element in linked list, -1 if end
-    };
+    using ListElement = PatternListElement<PatternType>;
 
     // Intrusive linked list tracking unsorted input patterns
     // INVARIANT: unsorted_patterns[i].in_list == 1  <=>  pattern i is currently unsorted
     // INVARIANT: first_used == END_OF_LIST  <=>  num_unsorted == 0
     // INVARIANT: num_unsorted == count of nodes in linked list
-    // PERFORMANCE: Stored in contiguous vector for cache efficiency
-    std::vector<ListElement> unsorted_patterns;
+    // PERFORMANCE: Stored in contiguous vector for cache efficiency, huge-page backed when enabled
+    HugePageVector<ListElement> unsorted_patterns;
     int first_used = END_OF_LIST;
     int num_unsorted = 0;
 
@@ -39,6 +53,14 @@ public:
     std::vector<Operation> operations;
     int current_level = 0;     // Current number of operations in the sequence
 
+    // As-soon-as-possible schedule of the operations applied so far.
+    // wire_layers[w] is the layer of the last operation on wire w (0 if none),
+    // and num_layers is the depth of the network scheduled this way, which is the
+    // minimum depth of any reordering that keeps the order of operations sharing
+    // a wire.
+    std::array<std::uint16_t, NetSize> wire_layers{};
+    int num_layers = 0;
+
     explicit State(const Config& config);
     State(const State& other) = default;
     State& operator=(const State& other) = default;
@@ -52,6 +74,9 @@ public:
     // or removing them if they become sorted.
     [[gnu::always_inline]] inline void update_state(int op1, int op2, const LookupTables& lookups);
 
+    // Apply a sequence of operations in order, e.g. to rebuild a beam entry's state.
+    HOT_KERNEL [[gnu::flatten]] void apply_operations(const Operation* ops, int count, const LookupTables& lookups);
+
     // Select a random unsorted pattern and apply a random valid operation to it.
     // By picking a random unsorted pattern first, we weight operations by how many
     // patterns they can affect. Operations valid for many patterns are more likely chosen.
@@ -59,21 +84,56 @@ public:
 
     void print_state() const;
 
-    // Greedy algorithm to minimize parallel depth by reordering operations.
-    // Attempts to maximize parallelism while preserving correctness.
-    [[gnu::flatten]] inline void minimise_depth(int net_size);
+    // Reorder the operations layer by layer, following the as-soon-as-possible
+    // schedule, so consecutive operations on disjoint wires form the layers.
+    void minimise_depth();
 
-    // Calculate the parallel depth (number of parallel layers) of the network.
-    // Two operations can be in the same layer if they use disjoint sets of wires.
-    [[gnu::flatten]] [[nodiscard]] inline int get_depth(int net_size) const;
+    // Parallel depth (number of parallel layers) of the network, as tracked by
+    // update_state(). Two operations can be in the same layer if they use
+    // disjoint sets of wires. The empty network has depth 1, as it always had
+    // before the layers were tracked, so reported depths keep their meaning.
+    [[nodiscard]] int get_depth() const { return std::max(num_layers, 1); }
 
     // Score this state using fixed number of Monte Carlo simulations.
-    // Runs exactly num_tests simulations and returns the mean score.
-    [[gnu::flatten]] [[nodiscard]] inline double score_state(int num_tests, double depth_weight, const LookupTables& lookups);
+    // Runs exactly num_tests simulations, built in scratch, and returns the mean score.
+    // If cancel is given and becomes true, stops early and returns the mean of the
+    // simulations run so far (the current one is cut short, see rollout_score()).
+    HOT_KERNEL [[gnu::flatten]] [[nodiscard]] inline double score_state(int num_tests, double depth_weight, State& scratch,
+                                                                        const LookupTables& lookups,
+                                                                        const std::atomic<bool>* cancel = nullptr) const;
+
+    // Run a single Monte Carlo simulation from this state and return its score.
+    // The random completion is built in scratch, so this state is left untouched
+    // and several threads can run rollouts from it at once. If cancel is given,
+    // it is polled every ROLLOUT_CANCEL_INTERVAL comparators, and a cancelled
+    // rollout returns the score of its incomplete network, which must be discarded.
+    HOT_KERNEL [[gnu::flatten]] [[nodiscard]] inline double rollout_score(State& scratch, double depth_weight, const LookupTables& lookups,
+                                                                          const std::atomic<bool>* cancel = nullptr) const;
 
     // Find all valid successor operations from current state.
     // An operation is valid if it would change at least one unsorted pattern.
-    [[nodiscard]] int find_successors(std::vector<std::vector<int>>& succ_ops, int net_size);
+    HOT_KERNEL [[nodiscard]] int find_successors(SuccessorRows& rows) const;
+
+    // Reseed the calling thread's random number generator for --seed. Each
+    // worker gets its own stream, derived from the seed and its index.
+    static void seed_thread_rng(std::uint64_t seed, int worker) {
+        std::seed_seq sequence{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32),
+                               static_cast<std::uint32_t>(worker)};
+        get_thread_rng().seed(sequence);
+    }
+
+    // Save and restore the calling thread's random number generator, for
+    // checkpoints.
+    static std::string save_thread_rng() {
+        std::ostringstream state;
+        state << get_thread_rng();
+        return state.str();
+    }
+
+    static void load_thread_rng(const std::string& state) {
+        std::istringstream input(state);
+        input >> get_thread_rng();
+    }
 
 private:
     // Thread-local random number generator for parallel execution.
@@ -120,6 +180,8 @@ void State<NetSize>::set_start_state(const Config& config, const LookupTables& l
     // Subtract (n+1) for the n+1 trivial sorted patterns (0 ones, 1 one, ..., n ones but sorted)
     num_unsorted = config.get_num_input_patterns() - (config.get_net_size() + 1);
     current_level = 0;
+    wire_layers.fill(0);
+    num_layers = 0;
 }
 
 // Apply a compare-exchange operation between wires op1 and op2.
@@ -128,6 +190,7 @@ void State<NetSize>::set_start_state(const Config& config, const LookupTables& l
 template<int NetSize>
 [[gnu::always_inline]] inline void State<NetSize>::update_state(int op1, int op2, const LookupTables& lookups) {
     int last_index = END_OF_LIST;
+    work_counters.pattern_touches += static_cast<std::uint64_t>(num_unsorted);
 
     for (int used_index = first_used; used_index != END_OF_LIST; ) {
         int next_index = unsorted_patterns[used_index].next;
@@ -171,6 +234,19 @@ template<int NetSize>
     operations[current_level].op1 = static_cast<std::uint8_t>(op1);
     operations[current_level].op2 = static_cast<std::uint8_t>(op2);
     current_level++;
+
+    // The operation runs one layer after the latest operation on either wire
+    const std::uint16_t layer = static_cast<std::uint16_t>(std::max(wire_layers[op1], wire_layers[op2]) + 1);
+    wire_layers[op1] = layer;
+    wire_layers[op2] = layer;
+    num_layers = std::max(num_layers, static_cast<int>(layer));
+}
+
+template<int NetSize>
+HOT_KERNEL [[gnu::flatten]] void State<NetSize>::apply_operations(const Operation* ops, int count, const LookupTables& lookups) {
+    for (int i = 0; i < count; ++i) {
+        update_state(ops[i].op1, ops[i].op2, lookups);
+    }
 }
 
 // Select a random unsorted pattern and apply a random valid operation.
@@ -190,7 +266,7 @@ template<int NetSize>
         n++;
     }
 
-    const auto& allowed = lookups.allowed_ops(true_index);
+    const auto allowed = lookups.allowed_ops(true_index);
     int rand_op = rand_int(static_cast<int>(allowed.size()) - 1);
     update_state(allowed[rand_op].op1, allowed[rand_op].op2, lookups);
 }
@@ -204,130 +280,97 @@ void State<NetSize>::print_state() const {
     std::cout << "Unsorted: " << num_unsorted << std::endl;
 }
 
-// Greedy depth minimization by reordering independent operations.
-// Two operations are independent (can be parallel) if they use different wires.
-// This algorithm greedily moves operations earlier when possible to reduce depth.
+// Layer the network in linear time: recompute each operation's as-soon-as-possible
+// layer, then stably bucket the operations by layer (a counting sort). Operations
+// that share a wire keep their relative order, so the network sorts the same inputs.
 template<int NetSize>
-[[gnu::flatten]] inline void State<NetSize>::minimise_depth(int net_size) {
-    bool altered;
-
-    do {
-        altered = false;
-        std::vector<int> used_ops1(net_size, 0);
-        std::vector<int> used_ops2(net_size, 0);
-
-        for (int l1 = 0; l1 < current_level; ++l1) {
-            if (used_ops1[operations[l1].op1] == 1 || used_ops1[operations[l1].op2] == 1) {
-                std::fill(used_ops2.begin(), used_ops2.end(), 0);
-
-                for (int l2 = l1; l2 < current_level; ++l2) {
-                    if (used_ops2[operations[l2].op1] == 1 || used_ops2[operations[l2].op2] == 1)
-                        break;
-
-                    if (used_ops1[operations[l2].op1] != 1 && used_ops1[operations[l2].op2] != 1) {
-                        used_ops1[operations[l2].op1] = 1;
-                        used_ops1[operations[l2].op2] = 1;
-
-                        std::swap(operations[l1], operations[l2]);
-
-                        l2 = l1;
-                        l1++;
-                        std::fill(used_ops2.begin(), used_ops2.end(), 0);
-                        altered = true;
-                        continue;
-                    }
-
-                    used_ops2[operations[l2].op1] = 1;
-                    used_ops2[operations[l2].op2] = 1;
-                }
-
-                std::fill(used_ops1.begin(), used_ops1.end(), 0);
-            }
-
-            used_ops1[operations[l1].op1] = 1;
-            used_ops1[operations[l1].op2] = 1;
-        }
-    } while (altered);
-}
-
-// Calculate parallel depth by counting how many layers are needed.
-// A new layer starts when an operation shares a wire with a previous operation
-// in the current layer.
-template<int NetSize>
-[[gnu::flatten]] inline int State<NetSize>::get_depth(int net_size) const {
-    std::vector<int> used_ops(net_size, 0);
-    int num_used = 1;
+void State<NetSize>::minimise_depth() {
+    std::array<std::uint16_t, NetSize> layer_of_wire{};
+    std::vector<std::uint16_t> layers(static_cast<std::size_t>(current_level));
+    std::vector<int> layer_start(static_cast<std::size_t>(num_layers) + 2, 0);
 
     for (int i = 0; i < current_level; ++i) {
-        if (used_ops[operations[i].op1] == 1 || used_ops[operations[i].op2] == 1) {
-            std::fill(used_ops.begin(), used_ops.end(), 0);
-            num_used++;
-        }
+        const Operation op = operations[i];
+        const std::uint16_t layer = static_cast<std::uint16_t>(std::max(layer_of_wire[op.op1], layer_of_wire[op.op2]) + 1);
+        layer_of_wire[op.op1] = layer;
+        layer_of_wire[op.op2] = layer;
+        layers[i] = layer;
+        layer_start[layer + 1]++;
+    }
 
-        used_ops[operations[i].op1] = 1;
-        used_ops[operations[i].op2] = 1;
+    for (int layer = 1; layer <= num_layers; ++layer) {
+        layer_start[layer + 1] += layer_start[layer];
     }
 
-    return num_used;
+    std::vector<Operation> layered(static_cast<std::size_t>(current_level));
+    for (int i = 0; i < current_level; ++i) {
+        layered[layer_start[layers[i]]++] = operations[i];
+    }
+    std::copy(layered.begin(), layered.end(), operations.begin());
 }
 
 // Score a state using fixed number of Monte Carlo simulations.
 // Runs exactly num_tests simulations and returns the mean score.
 template<int NetSize>
-[[gnu::flatten]] inline double State<NetSize>::score_state(int num_tests, double depth_weight, const LookupTables& lookups) {
+HOT_KERNEL [[gnu::flatten]] inline double State<NetSize>::score_state(int num_tests, double depth_weight, State& scratch,
+                                                                     const LookupTables& lookups,
+                                                                     const std::atomic<bool>* cancel) const {
     double total_score = 0.0;
-    State<NetSize> temp_state(*this);
-
-    for (int test = 0; test < num_tests; ++test) {
-        temp_state = *this;
 
-        // Complete the network with random operations
-        while (temp_state.num_unsorted > 0) {
-            temp_state.do_random_transition(lookups);
-        }
+    int test = 0;
+    while (test < num_tests) {
+        total_score += rollout_score(scratch, depth_weight, lookups, cancel);
+        ++test;
+        if (cancel != nullptr && cancel->load(std::memory_order_relaxed)) break;
+    }
 
-        temp_state.minimise_depth(NetSize);
+    return total_score / test;
+}
 
-        double length = temp_state.current_level;
-        double depth = temp_state.get_depth(NetSize);
-        double score = (1.0 - depth_weight) * length + depth_weight * depth;
-        total_score += score;
+// Complete a copy of this state with random operations and score the result.
+template<int NetSize>
+HOT_KERNEL [[gnu::flatten]] inline double State<NetSize>::rollout_score(State& scratch, double depth_weight, const LookupTables& lookups,
+                                                                      const std::atomic<bool>* cancel) const {
+    scratch = *this;
+
+    // Complete the network with random operations
+    int steps = 0;
+    while (scratch.num_unsorted > 0) {
+        scratch.do_random_transition(lookups);
+        if (cancel != nullptr && ++steps % ROLLOUT_CANCEL_INTERVAL == 0 &&
+            cancel->load(std::memory_order_relaxed)) {
+            break;
+        }
     }
+    work_counters.rollouts++;
+    SN_PROBE2(rollout_done, scratch.current_level, scratch.num_layers);
 
-    return total_score / num_tests;
+    double length = scratch.current_level;
+    double depth = scratch.get_depth();
+    return (1.0 - depth_weight) * length + depth_weight * depth;
 }
 
 // Find all valid successor operations from the current state.
 // An operation is valid if it would change at least one unsorted pattern.
 // Returns the number of valid successors found.
 template<int NetSize>
-int State<NetSize>::find_successors(std::vector<std::vector<int>>& succ_ops, int net_size) {
-    int allowed = 0;
-
-    for (auto& row : succ_ops) {
-        std::fill(row.begin(), row.end(), 0);
-    }
+HOT_KERNEL int State<NetSize>::find_successors(SuccessorRows& rows) const {
+    rows.fill(0);
 
-    // Check all unsorted patterns to see which operations would affect them
+    // A pattern is changed by (n1, n2) if it has a 0 at n1 and a 1 at n2, so
+    // every 0 wire n1 contributes the pattern's 1 wires above it to row n1.
+    // The row loop has a compile-time trip count and no branches, so it unrolls.
     for (int i = first_used; i != END_OF_LIST; i = unsorted_patterns[i].next) {
-        PatternType pattern = unsorted_patterns[i].bit_pattern;
-        for (int n1 = 0; n1 < net_size - 1; ++n1) {
-            for (int n2 = n1 + 1; n2 < net_size; ++n2) {
-                if (((pattern >> n1) & 1) == 0 && ((pattern >> n2) & 1) == 1) {
-                    succ_ops[n1][n2] = 1;
-                }
-            }
+        const Mask pattern = static_cast<Mask>(unsorted_patterns[i].bit_pattern);
+        for (int n1 = 0; n1 < NetSize - 1; ++n1) {
+            const Mask zero_at_n1 = static_cast<Mask>(((pattern >> n1) & 1u) - 1u);
+            rows[n1] |= static_cast<Mask>(pattern & Comparators<NetSize>::HIGHER_WIRES[n1] & zero_at_n1);
         }
     }
 
-    // Count total valid operations
-    for (int n1 = 0; n1 < net_size - 1; ++n1) {
-        for (int n2 = n1 + 1; n2 < net_size; ++n2) {
-            if (succ_ops[n1][n2] == 1) {
-                allowed++;
-            }
-        }
+    int allowed = 0;
+    for (int n1 = 0; n1 < NetSize - 1; ++n1) {
+        allowed += std::popcount(rows[n1]);
     }
-
     return allowed;
 }
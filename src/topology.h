@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <pthread.h>
+#include <sched.h>
+
+// CPU topology helpers (Linux-specific).
+// Used to choose a default thread count that respects the CPU affinity mask and
+// container CPU quotas, and to pin workers to CPUs on known NUMA nodes.
+
+// CPUs this process may run on, from its affinity mask.
+inline std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// CPU limit imposed by the cgroup CPU quota, rounded up, or 0 if unlimited.
+// Checks cgroup v2 (cpu.max) first, then cgroup v1 (cpu.cfs_quota_us).
+inline int cgroup_cpu_limit() {
+    double quota = -1.0;
+    double period = 0.0;
+
+    std::ifstream v2("/sys/fs/cgroup/cpu.max");
+    std::string quota_str;
+    if (v2 >> quota_str >> period) {
+        if (quota_str != "max") quota = std::stod(quota_str);
+    } else {
+        std::ifstream v1_quota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+        std::ifstream v1_period("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+        if (!(v1_quota >> quota) || !(v1_period >> period)) quota = -1.0;
+    }
+
+    if (quota <= 0.0 || period <= 0.0) return 0;
+    return std::max(1, static_cast<int>(std::ceil(quota / period)));
+}
+
+// Default number of worker threads: one per allowed CPU, capped by the cgroup quota.
+inline int default_thread_count() {
+    int count = std::max(1, static_cast<int>(allowed_cpus().size()));
+    int limit = cgroup_cpu_limit();
+    if (limit > 0) count = std::min(count, limit);
+    return count;
+}
+
+// NUMA node of a CPU, read from sysfs, or 0 if unknown.
+inline int numa_node_of_cpu(int cpu) {
+    for (int node = 0; node < 1024; ++node) {
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!cpulist) {
+            if (node > 0) break;
+            return 0;
+        }
+
+        // Format: comma-separated ranges, e.g. "0-15,32-47"
+        std::string range;
+        while (std::getline(cpulist, range, ',')) {
+            if (range.empty() || !std::isdigit(static_cast<unsigned char>(range[0]))) continue;
+            auto dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+            if (cpu >= first && cpu <= last) return node;
+        }
+    }
+    return 0;
+}
+
+// NUMA node of the CPU each of num_workers workers is pinned to. Worker w runs on
+// the w-th allowed CPU, wrapping around; without pinning every worker is on node 0.
+inline std::vector<int> worker_numa_nodes(int num_workers, bool pin_threads) {
+    std::vector<int> nodes(static_cast<std::size_t>(std::max(num_workers, 1)), 0);
+    const std::vector<int> cpus = allowed_cpus();
+    if (pin_threads && !cpus.empty()) {
+        for (std::size_t w = 0; w < nodes.size(); ++w) {
+            nodes[w] = numa_node_of_cpu(cpus[w % cpus.size()]);
+        }
+    }
+    return nodes;
+}
+
+// Pin the calling thread to a single CPU. Returns false on failure.
+inline bool pin_current_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Timeline of worker activity for --trace FILE, in the Chrome trace event format
+// (open it in Perfetto or chrome://tracing).
+//
+// Each worker records the begin and end of every task it runs (expanding a parent,
+// scoring a candidate, running a rollout) into its own ring buffer. The main
+// thread, which is worker 0, also records the phases of each level around them.
+// Only the owning worker writes to a buffer, and the buffers are read only after
+// the search, when the pool is idle, so recording needs no locks or atomics: an
+// event costs two clock reads and a store. When a buffer is full the oldest
+// events are overwritten, so a long run keeps its most recent activity.
+//
+// Gaps between a worker's tasks are idle time, e.g. waiting at the end of a
+// parallel loop for the slowest task.
+
+inline constexpr std::size_t TRACE_BUFFER_EVENTS = std::size_t{1} << 18;  // Per worker
+
+enum TraceKind : std::uint16_t {
+    // Phases, on worker 0 (arg: level); the first four in SearchPhase order
+    TRACE_COLLECT,          // Candidate collection
+    TRACE_SCORE,            // Scoring of one halving round
+    TRACE_SORT,             // Ranking of one halving round
+    TRACE_REBUILD,          // Beam rebuild
+    TRACE_LEVEL,            // A whole level
+    TRACE_DEDUP,            // Clearing the hash set, or sorting candidates by hash
+
+    // Tasks, on the worker that ran them
+    TRACE_EXPAND,           // Expanding one parent (arg: beam index)
+    TRACE_SCORE_CANDIDATE,  // Reconstructing and scoring one candidate (arg: candidate)
+    TRACE_RECONSTRUCT,      // Reconstructing one candidate for split rollouts (arg: candidate)
+    TRACE_ROLLOUT,          // One rollout of a split round (arg: rollout)
+    NUM_TRACE_KINDS
+};
+
+inline constexpr std::array<const char*, NUM_TRACE_KINDS> TRACE_KIND_NAMES = {
+    "collect", "score", "sort", "rebuild", "level", "dedup",
+    "expand", "score candidate", "reconstruct", "rollout"
+};
+
+struct TraceEvent {
+    std::uint64_t begin_ns;
+    std::uint64_t end_ns;
+    std::uint32_t arg;
+    TraceKind kind;
+};
+
+class Tracer {
+public:
+    // Opens the output file now, so a bad path is reported before the search.
+    explicit Tracer(const std::string& path)
+        : out_(path, std::ios::out | std::ios::trunc), epoch_(std::chrono::steady_clock::now()) {
+        if (!out_) {
+            throw std::runtime_error("Cannot open trace file " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    // Make room for num_workers buffers; each worker then calls allocate_buffer().
+    void set_num_workers(int num_workers) { buffers_.resize(static_cast<std::size_t>(num_workers)); }
+
+    // Allocate a worker's buffer from that worker, so its pages are local to it.
+    void allocate_buffer(int worker) {
+        buffers_[worker] = std::make_unique<Buffer>();
+        buffers_[worker]->events.resize(TRACE_BUFFER_EVENTS);
+    }
+
+    [[nodiscard]] std::uint64_t now() const {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch_).count());
+    }
+
+    void record(int worker, TraceKind kind, std::uint32_t arg, std::uint64_t begin_ns) {
+        Buffer& buffer = *buffers_[worker];
+        buffer.events[buffer.written % TRACE_BUFFER_EVENTS] = TraceEvent{begin_ns, now(), arg, kind};
+        buffer.written++;
+    }
+
+    // Write every buffered event as Chrome trace JSON. Call only while no worker
+    // is recording.
+    void write() {
+        out_ << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+        bool first = true;
+        for (std::size_t worker = 0; worker < buffers_.size(); ++worker) {
+            out_ << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << worker
+                 << ",\"args\":{\"name\":\"worker " << worker << (worker == 0 ? " (main)" : "") << "\"}}";
+            first = false;
+        }
+
+        char line[192];
+        for (std::size_t worker = 0; worker < buffers_.size(); ++worker) {
+            if (!buffers_[worker]) continue;
+            const Buffer& buffer = *buffers_[worker];
+            const std::size_t count = std::min(buffer.written, TRACE_BUFFER_EVENTS);
+            for (std::size_t n = buffer.written - count; n < buffer.written; ++n) {
+                const TraceEvent& event = buffer.events[n % TRACE_BUFFER_EVENTS];
+                std::snprintf(line, sizeof(line),
+                              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+                              "\"args\":{\"arg\":%u}}",
+                              TRACE_KIND_NAMES[event.kind], worker, event.begin_ns / 1e3,
+                              (event.end_ns - event.begin_ns) / 1e3, event.arg);
+                out_ << line;
+            }
+        }
+        out_ << "\n]}\n";
+        out_.flush();
+    }
+
+private:
+    struct Buffer {
+        std::vector<TraceEvent> events;
+        std::size_t written = 0;  // Events recorded so far, including overwritten ones
+    };
+
+    std::ofstream out_;
+    std::chrono::steady_clock::time_point epoch_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+// Records one event from construction to destruction, if tracing is enabled.
+class TraceSpan {
+public:
+    TraceSpan(Tracer* tracer, int worker, TraceKind kind, std::size_t arg = 0)
+        : tracer_(tracer), worker_(worker), kind_(kind), arg_(static_cast<std::uint32_t>(arg)),
+          begin_ns_(tracer != nullptr ? tracer->now() : 0) {}
+
+    ~TraceSpan() {
+        if (tracer_ != nullptr) tracer_->record(worker_, kind_, arg_, begin_ns_);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    Tracer* tracer_;
+    int worker_;
+    TraceKind kind_;
+    std::uint32_t arg_;
+    std::uint64_t begin_ns_;
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <type_traits>
 
@@ -14,6 +16,29 @@ struct StateSuccessor {
     double score = 0.0;
 };
 
+// Represents a candidate successor operation to be scored.
+// Used to batch all scoring work into a single parallel loop.
+// Records are kept compact, since wide beams hold hundreds of millions of them.
+struct CandidateSuccessor {
+    std::uint64_t canonical_hash; // Canonical hash for isomorphic deduplication
+    std::uint32_t beam_index;     // Which beam entry this belongs to
+    std::uint16_t comparator;     // Index into Comparators<NetSize>::OPS (< 2^9)
+};
+static_assert(sizeof(CandidateSuccessor) == 16);
+
+// A candidate and its score in the latest halving round.
+struct ScoredCandidate {
+    double score;
+    std::uint64_t index;          // Index into candidates
+};
+
+// How the large pattern arrays are backed (see huge_pages.h).
+enum class HugePageMode {
+    Off,          // Regular pages
+    Transparent,  // madvise(MADV_HUGEPAGE)
+    HugeTLB       // hugetlbfs pages, falling back to Transparent
+};
+
 template<int N>
 struct BitStorage {
     using type = std::conditional_t<(N <= 8), std::uint8_t,
@@ -21,7 +46,77 @@ struct BitStorage {
                    std::uint32_t>>;
 };
 
+// Node of a State's intrusive linked list of unsorted patterns (see state.h).
+template<typename PatternType>
+struct PatternListElement {
+    std::uint8_t in_list;      // 1 if this pattern is currently in the unsorted list
+    PatternType bit_pattern;   // The binary pattern value
+    int next;                  // Index of next element in linked list, -1 if end
+};
+
+// Set of wires of an N-wire network, bit w standing for wire w.
+template<int N>
+using WireMask = typename BitStorage<N>::type;
+
+// Compile-time tables of the N*(N-1)/2 comparators of an N-wire network.
+// Comparators are numbered in lexicographic (op1, op2) order, which is also the
+// order successors are enumerated in.
+template<int N>
+struct Comparators {
+    static constexpr int COUNT = N * (N - 1) / 2;
+
+    // Wires above w, i.e. the possible op2 of a comparator with op1 == w
+    static constexpr std::array<WireMask<N>, N> HIGHER_WIRES = []() {
+        std::array<WireMask<N>, N> masks{};
+        for (int w = 0; w < N; ++w) {
+            for (int v = w + 1; v < N; ++v) {
+                masks[w] = static_cast<WireMask<N>>(masks[w] | (1u << v));
+            }
+        }
+        return masks;
+    }();
+
+    static constexpr std::array<Operation, COUNT> OPS = []() {
+        std::array<Operation, COUNT> ops{};
+        int k = 0;
+        for (int op1 = 0; op1 < N - 1; ++op1) {
+            for (int op2 = op1 + 1; op2 < N; ++op2) {
+                ops[k++] = Operation{static_cast<std::uint8_t>(op1), static_cast<std::uint8_t>(op2)};
+            }
+        }
+        return ops;
+    }();
+
+    // Position of comparator (op1, op2), op1 < op2, in OPS
+    static constexpr int index(int op1, int op2) {
+        return op1 * (2 * N - op1 - 1) / 2 + (op2 - op1 - 1);
+    }
+};
+
+// HOT_KERNEL compiles a function once per x86-64 ISA level (baseline, v2 = SSE4.2,
+// v3 = AVX2, v4 = AVX-512), and the dynamic loader picks the best one for the
+// running CPU (ifunc). A single binary can then be deployed to every host.
+// Callees inlined into a kernel, e.g. via [[gnu::flatten]], are compiled with it.
+// Define NO_CPU_DISPATCH to build a single variant instead, e.g. with -march=native.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && !defined(NO_CPU_DISPATCH)
+    #define HOT_KERNEL [[gnu::target_clones("arch=x86-64-v4", "arch=x86-64-v3", "arch=x86-64-v2", "default")]]
+#else
+    #define HOT_KERNEL
+#endif
+
 inline constexpr int END_OF_LIST = -1;
 inline constexpr std::uint8_t INVALID_LABEL = 255;
 inline constexpr int MAX_NET_SIZE = 32;
 inline constexpr int NUM_NET_SIZE_CASES = 31;
+
+// When fewer than ROLLOUT_SPLIT_FACTOR active candidates per worker remain in a
+// halving round, individual rollouts rather than whole candidates are scheduled
+// across workers, so a few expensive candidates cannot leave most workers idle.
+inline constexpr std::size_t ROLLOUT_SPLIT_FACTOR = 4;
+
+// Workers copy their candidates into the shared candidate array in batches of
+// this many records.
+inline constexpr std::size_t CANDIDATE_FLUSH_SIZE = 4096;
+
+// CandidateSuccessor::comparator needs 9 bits for the largest networks
+static_assert(Comparators<MAX_NET_SIZE>::COUNT <= (1 << 9));
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// WorkerPool is a persistent set of worker threads that run parallel loops with
+// work stealing.
+//
+// A parallel loop is split into tasks of `grain` iterations, which are dealt out
+// round-robin to per-worker queues. A worker pops tasks from the back of its own
+// queue and, once that is empty, steals from the front of other workers' queues.
+// This balances the highly variable cost of expanding parents and running
+// rollouts without a central queue.
+//
+// Worker 0 is the thread that calls parallel_for(), which runs tasks alongside the
+// pool threads until the loop completes. Loops must not be nested, and only the
+// owning thread may start them.
+class WorkerPool {
+public:
+    explicit WorkerPool(int num_workers) : queues_(static_cast<std::size_t>(std::max(num_workers, 1))) {
+        for (int worker = 1; worker < size(); ++worker) {
+            threads_.emplace_back([this, worker]() { worker_loop(worker); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            stop_ = true;
+        }
+        wake_cv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    [[nodiscard]] int size() const { return static_cast<int>(queues_.size()); }
+
+    // Run body(worker, i) for every i in [0, n), in tasks of `grain` iterations.
+    template<typename Body>
+    void parallel_for(std::size_t n, std::size_t grain, Body&& body) {
+        if (n == 0) return;
+        grain = std::max<std::size_t>(grain, 1);
+
+        if (size() == 1 || n <= grain) {
+            for (std::size_t i = 0; i < n; ++i) body(0, i);
+            return;
+        }
+
+        Job job{&invoke_range<std::remove_reference_t<Body>>, &body, {}};
+        const std::size_t num_tasks = (n + grain - 1) / grain;
+        job.remaining.store(num_tasks, std::memory_order_relaxed);
+
+        for (std::size_t t = 0; t < num_tasks; ++t) {
+            auto& queue = queues_[t % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(Task{&job, t * grain, std::min(n, (t + 1) * grain), true});
+        }
+
+        run(job);
+    }
+
+    // Run body(worker) exactly once on every worker, e.g. to set up per-worker
+    // memory from the thread that will use it.
+    template<typename Body>
+    void run_on_each_worker(Body&& body) {
+        Job job{&invoke_worker<std::remove_reference_t<Body>>, &body, {}};
+        job.remaining.store(queues_.size(), std::memory_order_relaxed);
+
+        for (auto& queue : queues_) {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(Task{&job, 0, 0, false});
+        }
+
+        run(job);
+    }
+
+private:
+    struct Job {
+        void (*invoke)(void* body, int worker, std::size_t begin, std::size_t end);
+        void* body;
+        std::atomic<std::size_t> remaining;
+    };
+
+    struct Task {
+        Job* job;
+        std::size_t begin;
+        std::size_t end;
+        bool stealable;
+    };
+
+    // Tasks are pushed only while no loop is running; the owner pops from the
+    // back and thieves take from the front (head). Storage is kept between loops.
+    struct alignas(64) WorkerQueue {
+        std::mutex mutex;
+        std::vector<Task> tasks;
+        std::size_t head = 0;
+    };
+
+    std::vector<WorkerQueue> queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::uint64_t generation_ = 0;
+    bool stop_ = false;
+
+    std::mutex done_mutex_;
+    std::condition_variable done_cv_;
+
+    template<typename Body>
+    static void invoke_range(void* body, int worker, std::size_t begin, std::size_t end) {
+        auto& fn = *static_cast<Body*>(body);
+        for (std::size_t i = begin; i < end; ++i) fn(worker, i);
+    }
+
+    template<typename Body>
+    static void invoke_worker(void* body, int worker, std::size_t, std::size_t) {
+        (*static_cast<Body*>(body))(worker);
+    }
+
+    // Wake the pool, help run the job's tasks, then wait for stragglers.
+    void run(Job& job) {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            ++generation_;
+        }
+        wake_cv_.notify_all();
+
+        run_tasks(0);
+
+        std::unique_lock<std::mutex> lock(done_mutex_);
+        done_cv_.wait(lock, [&job]() { return job.remaining.load(std::memory_order_acquire) == 0; });
+    }
+
+    bool pop_own(int worker, Task& task) {
+        auto& queue = queues_[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.head == queue.tasks.size()) return false;
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        if (queue.head == queue.tasks.size()) {
+            queue.tasks.clear();
+            queue.head = 0;
+        }
+        return true;
+    }
+
+    bool steal(int thief, Task& task) {
+        const int n = size();
+        for (int offset = 1; offset < n; ++offset) {
+            auto& queue = queues_[(thief + offset) % n];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.head == queue.tasks.size() || !queue.tasks[queue.head].stealable) continue;
+            task = queue.tasks[queue.head++];
+            if (queue.head == queue.tasks.size()) {
+                queue.tasks.clear();
+                queue.head = 0;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void run_tasks(int worker) {
+        Task task;
+        while (pop_own(worker, task) || steal(worker, task)) {
+            Job& job = *task.job;
+            job.invoke(job.body, worker, task.begin, task.end);
+            if (job.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(done_mutex_);
+                done_cv_.notify_all();
+            }
+        }
+    }
+
+    void worker_loop(int worker) {
+        std::uint64_t seen_generation = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex_);
+                wake_cv_.wait(lock, [&]() { return stop_ || generation_ != seen_generation; });
+                if (stop_) return;
+                seen_generation = generation_;
+            }
+            run_tasks(worker);
+        }
+    }
+};